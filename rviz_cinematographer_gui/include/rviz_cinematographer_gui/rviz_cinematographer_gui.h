@@ -549,6 +549,9 @@ private:
 
   /** @brief True if recorder was destructed. */
   bool recorder_running_;
+
+  /** @brief Id of the last requested recording. */
+  uint32_t recording_id_;
 };
 
 } // namespace
@@ -17,6 +17,7 @@ RvizCinematographerGUI::RvizCinematographerGUI()
     , widget_(0)
     , current_marker_name_("")
     , recorder_running_(true)
+    , recording_id_(static_cast<uint32_t>(ros::WallTime::now().toNSec()))
 {
   //cam_pose_.orientation.w = 1.0;
 
@@ -1060,6 +1061,8 @@ void RvizCinematographerGUI::publishRecordParams()
 {
   rviz_cinematographer_msgs::Record record_params;
   record_params.do_record = true;
+  // the id is seeded from the time, so that a restarted GUI does not repeat the id of the previous recording 
+  record_params.recording_id = ++recording_id_;
   record_params.path_to_output = ui_.video_output_path_line_edit->text().toStdString();
   record_params.frames_per_second = ui_.video_fps_spin_box->value();
   record_params.compress = ui_.video_compressed_check_box->isChecked();
@@ -53,16 +53,19 @@
 #include <ros/subscriber.h>
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
 
 #include <rviz_cinematographer_msgs/CameraMovement.h>
 #include <rviz_cinematographer_msgs/CameraTrajectory.h>
 #include <rviz_cinematographer_msgs/Record.h>
 #include <rviz_cinematographer_msgs/Finished.h>
-#include <rviz_cinematographer_msgs/Wait.h>
+#include <rviz_cinematographer_msgs/Credits.h>
 #include <std_msgs/Empty.h>
 
 #include <nav_msgs/Odometry.h>
 
+#include <nodelet/loader.h>
+
 #include <OGRE/OgreVector3.h>
 #include <OGRE/OgreQuaternion.h>
 #include <OGRE/OgreRenderWindow.h>
@@ -70,8 +73,14 @@
 #include <OGRE/OgreSceneNode.h>
 #include <OGRE/OgreSceneManager.h>
 #include <OGRE/OgreCamera.h>
+#include <OGRE/OgreTextureManager.h>
+#include <OGRE/OgreRenderTexture.h>
+#include <OGRE/OgreHardwarePixelBuffer.h>
 
 #include <boost/circular_buffer.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
 
 #include <cv.hpp>
 
@@ -125,6 +134,14 @@ public:
 
   typedef boost::circular_buffer<OgreCameraMovement> BufferCamMovements;
 
+  /** @brief Camera pose of a frame of the trajectory. */
+  struct CameraPose
+  {
+    Ogre::Vector3 eye;
+    Ogre::Vector3 focus;
+    Ogre::Vector3 up;
+  };
+
   CinematographerViewController();
   virtual ~CinematographerViewController();
 
@@ -239,6 +256,9 @@ protected Q_SLOTS:
   /** @brief Called when camera trajectory topic is changed; updates subscriber to camera trajectories. */
   void updateTopics();
 
+  /** @brief Called when in-process recorder property is changed; loads or unloads the video recorder nodelet. */
+  void updateInProcessRecorder();
+
 protected:  //methods
   /** @brief Called at 30Hz by ViewManager::update() while this view is active.
    *
@@ -315,11 +335,57 @@ protected:  //methods
    */
   void setRecord(const rviz_cinematographer_msgs::Record::ConstPtr& record_params);
 
-  /** @brief Sets the duration the rendering has to wait for.
+  /** @brief Stores the credits advertised by the recorder.
+   *
+   * Credits of other recordings than the current one are ignored.
    *
-   * @params[in] wait_duration  duration to wait for.
+   * @params[in] credits    free slots of the recorder and number of frames it received.
    */
-  void setWaitDuration(const rviz_cinematographer_msgs::Wait::ConstPtr& wait_duration);
+  void setCredits(const rviz_cinematographer_msgs::Credits::ConstPtr& credits);
+
+  /** @brief Returns true if the recorder can take another frame without blocking. */
+  bool hasCredits() const;
+
+  /** @brief Returns true if the next frame of the recording has to wait for credits of the recorder. */
+  bool isWaitingForCredits() const;
+
+  /** @brief Advances the camera along the current movement by one frame and publishes it if recording.
+   *
+   * @params[in] ros_dt     duration since the previous frame in seconds.
+   */
+  void animate(float ros_dt);
+
+  /** @brief Renders and publishes the frames of the recording back-to-back, only throttled by the recorder's credits.
+   *
+   * Renders for a bounded time per update, so that rviz stays responsive.
+   */
+  void renderOffline();
+
+  /** @brief Updates the render rate property and logs it once the recording is finished.
+   *
+   * @params[in] is_finished    true if the last frame of the recording was rendered.
+   */
+  void reportRenderRate(bool is_finished);
+
+  /** @brief Advances the frame-by-frame animation by frames_to_skip_ frames without rendering them.
+   *
+   * The last frame of the trajectory is never skipped, so that the recording finishes as usual.
+   */
+  void skipFrames();
+
+  /** @brief Samples the movements that were added to the buffer since the last call into the pose table.
+   *
+   * The frames are sampled at multiples of the frame duration of target_fps_ from the start of the trajectory, so
+   * that no timing error accumulates over the movements. The last frame is the goal of the last movement. If the frame
+   * rate changed, the whole trajectory is sampled again and the index of the next frame is scaled accordingly.
+   */
+  void samplePoseTable();
+
+  /** @brief Clears the pose table, e.g. if the trajectory is finished or canceled. */
+  void resetPoseTable();
+
+  /** @brief Publishes that the rendering is finished once the recorder received all published frames. */
+  void publishFinishedRenderingIfReceived();
 
   Ogre::Vector3 fixedFrameToAttachedLocal(const Ogre::Vector3& v) { return reference_orientation_.Inverse() * (v - reference_position_); }
   Ogre::Vector3 attachedLocalToFixedFrame(const Ogre::Vector3& v) { return reference_position_ + (reference_orientation_ * v); }
@@ -334,9 +400,46 @@ protected:  //methods
    */
   float computeRelativeProgressInSpace(double relative_progress_in_time, uint8_t interpolation_speed);
 
-  /** @brief Publish the rendered image that is visible to the user in rviz. */
+  /** @brief Publish the rendered image that is visible to the user in rviz.
+   *
+   * The framebuffer is read directly into a pooled message - see acquireViewImage(). If the recorder runs in the same
+   * process, the message is passed without serialization, so the readback is the only copy on the way to the recorder.
+   */
   void publishViewImage();
 
+  /** @brief Returns a pooled image message of the given size that nobody else holds anymore.
+   *
+   * The messages are reference counted - a message is reused as soon as the publisher and all subscribers in the same
+   * process released it, so that the readback neither allocates nor clears a frame buffer. A resized window clears the
+   * pool. If all pooled messages are in use, a new one is allocated and pooled up to a bounded pool size.
+   *
+   * @params[in]    width   width of the image.
+   * @params[in]    height  height of the image.
+   * @params[in]    step    length of an image row in bytes.
+   */
+  sensor_msgs::ImagePtr acquireViewImage(unsigned int width, unsigned int height, unsigned int step);
+
+  /** @brief Hands the read back image to the publisher thread - blocks while its queue is full. */
+  void enqueueViewImage(const sensor_msgs::ImagePtr& image, const ros::Time& stamp, const std::string& frame_id);
+
+  /** @brief Blocks until the publisher thread published all images handed to it. */
+  void waitUntilViewImagesPublished();
+
+  /** @brief Stamps and publishes the read back images in a separate thread, so that the render thread only reads the
+   * framebuffer.
+   */
+  void publishViewImages();
+
+  /** @brief Renders the frame to record and returns the render target it is read from.
+   *
+   * If the recording requested a resolution, the scene is rendered by the camera into an offscreen render texture of
+   * that resolution, independent of the size of the rviz window. Otherwise the frame shown in the window is returned.
+   */
+  Ogre::RenderTarget* renderRecordedFrame();
+
+  /** @brief Creates, resizes or destroys the offscreen render texture to match the requested resolution. */
+  void updateRenderTexture();
+
 protected:    //members
 
   ros::NodeHandle nh_;
@@ -357,6 +460,10 @@ protected:    //members
   
   rviz::FloatProperty* window_width_property_;            ///< The width of the rviz visualization window in pixels.
   rviz::FloatProperty* window_height_property_;           ///< The height of the rviz visualization window in pixels.
+  rviz::FloatProperty* render_rate_property_;             ///< The rate the frames are rendered at offline in fps.
+
+  rviz::BoolProperty* in_process_recorder_property_;      ///< If True, the video recorder nodelet is loaded into rviz.
+  boost::shared_ptr<nodelet::Loader> recorder_loader_;
     
   rviz::TfFrameProperty* attached_frame_property_;
   Ogre::SceneNode* attached_scene_node_;
@@ -366,30 +473,63 @@ protected:    //members
 
   // Variables used during animation
   bool animate_;
-  ros::WallTime transition_start_time_;
-  BufferCamMovements cam_movements_buffer_;
+  ros::WallTime transition_start_time_;   ///< Time the playback of the trajectory started.
+  BufferCamMovements cam_movements_buffer_;   ///< Movements of the trajectory - the first one is its start pose.
+  std::vector<CameraPose> pose_table_;    ///< Poses of the frames of the sampled movements.
+  size_t pose_table_index_;               ///< Index of the next frame in the pose table.
+  size_t sampled_movements_;              ///< Number of movements of the buffer that are sampled.
+  double sampled_duration_;               ///< Duration of the sampled movements in seconds.
+  int pose_table_fps_;                    ///< Frame rate the pose table was sampled at.
 
   std::shared_ptr<rviz::Shape> focal_shape_;    ///< A small ellipsoid to show the focus point.
   bool dragging_;         ///< A flag indicating the dragging state of the mouse.
 
   QCursor interaction_disabled_cursor_;         ///< A cursor for indicating mouse interaction is disabled.
 
+  ros::CallbackQueue credits_callback_queue_;   ///< Declared before the subscriber, which has to be shut down first.
   ros::Subscriber trajectory_sub_;
   ros::Subscriber record_params_sub_;
-  ros::Subscriber wait_duration_sub_;
+  ros::Subscriber credits_sub_;
 
   ros::Publisher placement_pub_;
   ros::Publisher odometry_pub_;
   ros::Publisher finished_rendering_trajectory_pub_;
   ros::Publisher delete_pub_;
   image_transport::Publisher image_pub_;
+  std::vector<sensor_msgs::ImagePtr> view_image_pool_;  ///< Messages the rendered images are read into.
+
+  /** @brief Read back image waiting for the publisher thread. */
+  struct QueuedViewImage
+  {
+    sensor_msgs::ImagePtr image;
+    ros::Time stamp;                      ///< Time the image was read back.
+    std::string frame_id;
+  };
+
+  std::deque<QueuedViewImage> view_image_queue_;  ///< Images handed to the publisher thread.
+  uint32_t view_image_seq_;               ///< Sequence number of the next published image - never reset.
+  bool is_publishing_view_image_;         ///< True while the publisher thread publishes an image.
+  bool is_shutting_down_;
+  boost::mutex view_image_mutex_;
+  boost::condition_variable view_image_condition_;  ///< Notified if the queue or the publishing state changed.
+  boost::thread view_image_publisher_thread_;
 
   bool render_frame_by_frame_;
   int target_fps_;
-  int recorded_frames_counter_;
-
-  bool do_wait_;
-  float wait_duration_;
+  uint64_t frames_to_skip_;               ///< Number of frames before the start frame of a resumed recording.
+  bool is_rendering_offline_;             ///< True if the frames are rendered back-to-back instead of once per update.
+  ros::WallTime render_start_time_;       ///< Time the first frame was rendered offline.
+  unsigned int render_width_;             ///< Width of the recorded frames - zero records the rviz window.
+  unsigned int render_height_;            ///< Height of the recorded frames - zero records the rviz window.
+  Ogre::TexturePtr render_texture_;       ///< Offscreen target the recorded frames are rendered into.
+
+  uint32_t recording_id_;                 ///< Id of the current recording - credits of other recordings are ignored.
+  rviz_cinematographer_msgs::Credits::ConstPtr latest_credits_;  ///< Last received credits of any recording.
+  uint32_t credits_free_slots_;           ///< Number of frames the recorder can buffer.
+  uint64_t credits_received_frames_;      ///< Number of frames the recorder received so far plus the lost frames.
+  uint64_t credits_lost_frames_;          ///< Number of frames the recorder never received.
+  uint64_t published_frames_counter_;     ///< Number of frames published during the current recording.
+  bool is_finishing_rendering_;           ///< True if all frames are published but not yet received by the recorder.
 };
 
 }  // namespace rviz_cinematographer_view_controller
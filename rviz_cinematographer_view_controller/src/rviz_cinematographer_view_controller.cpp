@@ -37,6 +37,10 @@ using namespace rviz;
 static const std::string MODE_ORBIT = "Orbit";
 static const std::string MODE_FPS = "FPS";
 
+// Name and type of the video recorder nodelet if it is loaded into rviz
+static const std::string RECORDER_NODELET_NAME = "/video_recorder_nodelet";
+static const std::string RECORDER_NODELET_TYPE = "video_recorder/video_recorder_nodelet";
+
 // Limits to prevent orbit controller singularity, but not currently used.
 static const Ogre::Radian PITCH_LIMIT_LOW  = Ogre::Radian(0.02);
 static const Ogre::Radian PITCH_LIMIT_HIGH = Ogre::Radian(Ogre::Math::PI - 0.02);
@@ -65,12 +69,26 @@ static inline geometry_msgs::Vector3 vectorOgreToMsg(const Ogre::Vector3& o)
 CinematographerViewController::CinematographerViewController()
   : nh_("")
     , animate_(false)
+    , pose_table_index_(0)
+    , sampled_movements_(0)
+    , sampled_duration_(0.0)
+    , pose_table_fps_(0)
     , dragging_(false)
+    , view_image_seq_(0)
+    , is_publishing_view_image_(false)
+    , is_shutting_down_(false)
     , render_frame_by_frame_(false)
     , target_fps_(60)
-    , recorded_frames_counter_(0)
-    , do_wait_(false)
-    , wait_duration_(-1.f)
+    , frames_to_skip_(0)
+    , is_rendering_offline_(false)
+    , render_width_(0)
+    , render_height_(0)
+    , recording_id_(0)
+    , credits_free_slots_(1)
+    , credits_received_frames_(0)
+    , credits_lost_frames_(0)
+    , published_frames_counter_(0)
+    , is_finishing_rendering_(false)
 {
   interaction_disabled_cursor_ = makeIconCursor("package://rviz/icons/forbidden.svg");
 
@@ -102,6 +120,12 @@ CinematographerViewController::CinematographerViewController()
   
   window_width_property_        = new FloatProperty("Window Width", 1000, "The width of the rviz visualization window in pixels.", this);
   window_height_property_       = new FloatProperty("Window Height", 1000, "The height of the rviz visualization window in pixels.", this);
+  render_rate_property_         = new FloatProperty("Render Rate in fps", 0, "The rate the frames of the current offline recording are rendered at.", this);
+
+  in_process_recorder_property_ = new BoolProperty("In-Process Recorder", false,
+                                                   "Loads the video recorder into rviz so that rendered images are passed without serialization. "
+                                                   "Don't start another video recorder if enabled.",
+                                                   this, SLOT(updateInProcessRecorder()));
   
   // TODO: latch?
   placement_pub_ = nh_.advertise<geometry_msgs::Pose>("/rviz/current_camera_pose", 1);
@@ -110,33 +134,180 @@ CinematographerViewController::CinematographerViewController()
   delete_pub_ = nh_.advertise<std_msgs::Empty>("/rviz/delete", 1);
 
   image_transport::ImageTransport it(nh_);
-  image_pub_ = it.advertise("/rviz/view_image", 1);
+  image_pub_ = it.advertise("/rviz/view_image", rviz_cinematographer_msgs::Credits::MAX_FREE_SLOTS);
 
   record_params_sub_ = nh_.subscribe("/rviz/record", 1, &CinematographerViewController::setRecord, this);
-  wait_duration_sub_ = nh_.subscribe("/video_recorder/wait_duration", 1,
-                                     &CinematographerViewController::setWaitDuration, this);
+  // the credits are processed while rendering offline, i.e. within a single update of rviz 
+  ros::NodeHandle credits_nh(nh_);
+  credits_nh.setCallbackQueue(&credits_callback_queue_);
+  credits_sub_ = credits_nh.subscribe("/video_recorder/credits", 1, &CinematographerViewController::setCredits, this);
+
+  view_image_publisher_thread_ = boost::thread(&CinematographerViewController::publishViewImages, this);
 }
 
 CinematographerViewController::~CinematographerViewController()
 {
+  {
+    boost::mutex::scoped_lock lock(view_image_mutex_);
+    is_shutting_down_ = true;
+  }
+  view_image_condition_.notify_all();
+  view_image_publisher_thread_.join();
+
+  render_width_ = 0;
+  render_height_ = 0;
+  updateRenderTexture();
   context_->getSceneManager()->destroySceneNode(attached_scene_node_);
 }
 
 void CinematographerViewController::setRecord(const rviz_cinematographer_msgs::Record::ConstPtr& record_params)
 {
+  // the previous recording has to be finished before the credits are reset
+  if(is_finishing_rendering_)
+  {
+    credits_received_frames_ = published_frames_counter_;
+    publishFinishedRenderingIfReceived();
+  }
+
   render_frame_by_frame_ = record_params->do_record > 0;
+  frames_to_skip_ = render_frame_by_frame_ ? record_params->start_frame : 0;
+  is_rendering_offline_ = render_frame_by_frame_ && record_params->render_offline;
+
+  // the render texture is created in the render thread before the first frame is published
+  const bool has_render_size = record_params->render_width > 0 && record_params->render_height > 0;
+  render_width_ = has_render_size ? record_params->render_width : 0;
+  render_height_ = has_render_size ? record_params->render_height : 0;
+  // the first frame waits for the credits the recorder publishes once it set up this recording - frames sent before
+  // would end up in the previous recording 
+  recording_id_ = record_params->recording_id;
+  published_frames_counter_ = 0;
+  credits_received_frames_ = 0;
+  credits_lost_frames_ = 0;
+  credits_free_slots_ = 0;
 
   int max_fps = 120;
-  if(record_params->compress == 0)
+  if(record_params->lossless == 0 && record_params->encoder == rviz_cinematographer_msgs::Record::OPENCV &&
+     record_params->compress == 0)
     max_fps = 60;
 
   target_fps_ = std::max(1, std::min(max_fps, (int)record_params->frames_per_second));
+
+  if(latest_credits_ && latest_credits_->recording_id == recording_id_)
+    setCredits(latest_credits_);
+}
+
+void CinematographerViewController::setCredits(const rviz_cinematographer_msgs::Credits::ConstPtr& credits)
+{
+  // credits of a previous recording may still be in flight - the credits of the next recording may arrive before its
+  // record message, so the latest credits are kept for setRecord() 
+  latest_credits_ = credits;
+  if(credits->recording_id != recording_id_)
+    return;
+
+  // frames dropped on the way to the recorder are never received - their credits are returned as lost frames 
+  if(credits->lost_frames > credits_lost_frames_)
+    ROS_WARN_STREAM("The recorder did not receive " << credits->lost_frames - credits_lost_frames_
+                    << " frames. Continuing without them.");
+  credits_lost_frames_ = credits->lost_frames;
+  credits_free_slots_ = credits->free_slots;
+  credits_received_frames_ = std::min(credits->received_frames + credits->lost_frames, published_frames_counter_);
+}
+
+bool CinematographerViewController::hasCredits() const
+{
+  uint64_t frames_in_transit = published_frames_counter_ > credits_received_frames_ ?
+                               published_frames_counter_ - credits_received_frames_ : 0;
+  return frames_in_transit < credits_free_slots_;
+}
+
+void CinematographerViewController::skipFrames()
+{
+  if(pose_table_.empty())
+    return;
+
+  const uint64_t skippable_frames = pose_table_.size() - 1 - std::min(pose_table_index_, pose_table_.size() - 1);
+  pose_table_index_ += static_cast<size_t>(std::min(frames_to_skip_, skippable_frames));
+  frames_to_skip_ = 0;
+}
+
+void CinematographerViewController::samplePoseTable()
+{
+  if(pose_table_fps_ != target_fps_)
+  {
+    if(pose_table_fps_ > 0)
+      pose_table_index_ = pose_table_index_ * target_fps_ / pose_table_fps_;
+    pose_table_.clear();
+    sampled_movements_ = 0;
+    sampled_duration_ = 0.0;
+    pose_table_fps_ = target_fps_;
+  }
+
+  if(cam_movements_buffer_.size() < 2 || sampled_movements_ == cam_movements_buffer_.size())
+    return;
+
+  // the goal of the last sampled movement is replaced by the frames of the new movements - the first movement in the
+  // buffer is the start pose
+  if(!pose_table_.empty())
+    pose_table_.pop_back();
+  sampled_movements_ = std::max(sampled_movements_, static_cast<size_t>(1));
+
+  for(; sampled_movements_ < cam_movements_buffer_.size(); ++sampled_movements_)
+  {
+    const OgreCameraMovement& start = cam_movements_buffer_[sampled_movements_ - 1];
+    const OgreCameraMovement& goal = cam_movements_buffer_[sampled_movements_];
+    const double start_time = sampled_duration_;
+    const double duration = goal.transition_duration.toSec();
+    sampled_duration_ += duration;
+
+    // a frame at the end of the movement is the first frame of the next one
+    const double end_frame = sampled_duration_ * pose_table_fps_ - 1e-6;
+    for(size_t frame = pose_table_.size(); static_cast<double>(frame) < end_frame; ++frame)
+    {
+      const double time = static_cast<double>(frame) / pose_table_fps_;
+      const double relative_progress_in_time = std::min(1.0, std::max(0.0, (time - start_time) / duration));
+      const float relative_progress_in_space = computeRelativeProgressInSpace(relative_progress_in_time,
+                                                                              goal.interpolation_speed);
+
+      CameraPose pose;
+      pose.eye = start.eye + relative_progress_in_space * (goal.eye - start.eye);
+      pose.focus = start.focus + relative_progress_in_space * (goal.focus - start.focus);
+      pose.up = start.up + relative_progress_in_space * (goal.up - start.up);
+      pose_table_.push_back(pose);
+    }
+  }
+
+  // make sure we get all the way there
+  const OgreCameraMovement& goal = cam_movements_buffer_.back();
+  CameraPose pose;
+  pose.eye = goal.eye;
+  pose.focus = goal.focus;
+  pose.up = goal.up;
+  pose_table_.push_back(pose);
 }
 
-void CinematographerViewController::setWaitDuration(const rviz_cinematographer_msgs::Wait::ConstPtr& wait_duration)
+void CinematographerViewController::resetPoseTable()
 {
-  wait_duration_ = wait_duration->seconds;
-  do_wait_ = true;
+  pose_table_.clear();
+  pose_table_index_ = 0;
+  sampled_movements_ = 0;
+  sampled_duration_ = 0.0;
+}
+
+void CinematographerViewController::publishFinishedRenderingIfReceived()
+{
+  // the recorder has to receive the last image before this "finished"-message - a slow recorder is waited for as
+  // long as it is connected 
+  if(credits_received_frames_ < published_frames_counter_ && image_pub_.getNumSubscribers() > 0 &&
+     credits_sub_.getNumPublishers() > 0)
+    return;
+
+  // the last images have to be published before the "finished"-message 
+  waitUntilViewImagesPublished();
+
+  rviz_cinematographer_msgs::Finished finished;
+  finished.is_finished = true;
+  finished_rendering_trajectory_pub_.publish(finished);
+  is_finishing_rendering_ = false;
 }
 
 void CinematographerViewController::updateTopics()
@@ -146,6 +317,29 @@ void CinematographerViewController::updateTopics()
                           boost::bind(&CinematographerViewController::cameraTrajectoryCallback, this, _1));
 }
 
+void CinematographerViewController::updateInProcessRecorder()
+{
+  if(in_process_recorder_property_->getBool())
+  {
+    if(recorder_loader_)
+      return;
+
+    recorder_loader_ = boost::make_shared<nodelet::Loader>(false);
+    nodelet::M_string remappings;
+    nodelet::V_string args;
+    if(!recorder_loader_->load(RECORDER_NODELET_NAME, RECORDER_NODELET_TYPE, remappings, args))
+    {
+      ROS_ERROR_STREAM("Could not load " << RECORDER_NODELET_TYPE << " into rviz.");
+      recorder_loader_.reset();
+    }
+  }
+  else if(recorder_loader_)
+  {
+    recorder_loader_->unload(RECORDER_NODELET_NAME);
+    recorder_loader_.reset();
+  }
+}
+
 void CinematographerViewController::onInitialize()
 {
   attached_frame_property_->setFrameManager(context_->getFrameManager());
@@ -509,6 +703,7 @@ void CinematographerViewController::beginNewTransition(const Ogre::Vector3& eye,
   if(cam_movements_buffer_.empty())
   {
     transition_start_time_ = ros::WallTime::now();
+    resetPoseTable();
 
     cam_movements_buffer_.push_back(std::move(OgreCameraMovement(eye_point_property_->getVector(),
                                                                  focus_point_property_->getVector(),
@@ -529,14 +724,19 @@ void CinematographerViewController::cancelTransition()
 {
   animate_ = false;
   cam_movements_buffer_.clear();
-  recorded_frames_counter_ = 0;
+  resetPoseTable();
 
-  if(render_frame_by_frame_)
+  // a pending "finished"-message is published right away as well 
+  if(render_frame_by_frame_ || is_finishing_rendering_)
   {
+    // the last images have to be published before the "finished"-message 
+    waitUntilViewImagesPublished();
+
     rviz_cinematographer_msgs::Finished finished;
     finished.is_finished = true;
     finished_rendering_trajectory_pub_.publish(finished);
     render_frame_by_frame_ = false;
+    is_finishing_rendering_ = false;
   }
 }
 
@@ -655,96 +855,123 @@ float CinematographerViewController::computeRelativeProgressInSpace(double relat
   }
 }
 
-void CinematographerViewController::update(float dt, float ros_dt)
+bool CinematographerViewController::isWaitingForCredits() const
 {
-  updateAttachedSceneNode();
+  // when recording, the next frame is only rendered if the recorder can take it
+  return render_frame_by_frame_ && image_pub_.getNumSubscribers() > 0 && credits_sub_.getNumPublishers() > 0 &&
+         !hasCredits();
+}
+
+void CinematographerViewController::animate(float ros_dt)
+{
+  // recordings take the next frame, otherwise the frame of the time passed since the start of the trajectory is shown
+  if(!render_frame_by_frame_)
+    pose_table_index_ = static_cast<size_t>((ros::WallTime::now() - transition_start_time_).toSec() * pose_table_fps_);
 
-  // there has to be at least two positions in the buffer - start and goal
-  if(animate_ && cam_movements_buffer_.size() > 1)
+  if(pose_table_index_ >= pose_table_.size() - 1)
   {
-    auto start = cam_movements_buffer_.begin();
-    auto goal = ++(cam_movements_buffer_.begin());
+    pose_table_index_ = pose_table_.size() - 1;
+    animate_ = false;
+  }
+
+  const CameraPose& pose = pose_table_[pose_table_index_++];
+
+  Ogre::Vector3 velocity = (pose.eye - eye_point_property_->getVector()) / ros_dt;
+  transition_velocity_property_->setFloat(velocity.normalise());
+
+  if(odometry_pub_.getNumSubscribers() != 0)
+    publishOdometry(pose.eye, velocity);
+
+  disconnectPositionProperties();
+  eye_point_property_->setVector(pose.eye);
+  focus_point_property_->setVector(pose.focus);
+  up_vector_property_->setVector(pose.up);
+  distance_property_->setFloat(getDistanceFromCameraToFocalPoint());
+  connectPositionProperties();
+
+  // This needs to happen so that the camera orientation will update properly when fixed_up_property == false
+  camera_->setFixedYawAxis(true, reference_orientation_ * up_vector_property_->getVector());
+  camera_->setDirection(reference_orientation_ * (focus_point_property_->getVector() - eye_point_property_->getVector()));
+
+  publishCameraPose();
+
+  if(render_frame_by_frame_ && image_pub_.getNumSubscribers() > 0)
+    publishViewImage();
 
-    double relative_progress_in_time = 0.0;
+  // if the trajectory is over
+  if(!animate_)
+  {
+    // clean up
+    cam_movements_buffer_.clear();
+    resetPoseTable();
+
+    // publish that the rendering is finished as soon as the recorder received the last image
     if(render_frame_by_frame_)
     {
-      relative_progress_in_time = recorded_frames_counter_ / (target_fps_ * goal->transition_duration.toSec());
-      recorded_frames_counter_++;
-    }
-    else
-    {
-      ros::WallDuration duration_from_start = ros::WallTime::now() - transition_start_time_;
-      relative_progress_in_time = duration_from_start.toSec() / goal->transition_duration.toSec();
+      if(is_rendering_offline_)
+        reportRenderRate(true);
+      render_frame_by_frame_ = false;
+      is_finishing_rendering_ = true;
+      publishFinishedRenderingIfReceived();
     }
+  }
+}
+
+void CinematographerViewController::renderOffline()
+{
+  // render back-to-back for a bounded time per update, so that rviz stays responsive and updates its displays 
+  const ros::WallTime end_time = ros::WallTime::now() + ros::WallDuration(0.1);
+  if(published_frames_counter_ == 0)
+    render_start_time_ = ros::WallTime::now();
 
-    // make sure we get all the way there before turning off
-    if(relative_progress_in_time >= 1.0)
+  while(animate_ && render_frame_by_frame_ && !pose_table_.empty() && ros::WallTime::now() < end_time)
+  {
+    // only throttled by the credits of the recorder 
+    if(isWaitingForCredits())
     {
-      relative_progress_in_time = 1.0;
-      animate_ = false;
+      credits_callback_queue_.callAvailable(ros::WallDuration(0.001));
+      continue;
     }
 
-    float relative_progress_in_space = computeRelativeProgressInSpace(relative_progress_in_time,
-                                                                      goal->interpolation_speed);
+    animate(1.f / static_cast<float>(target_fps_));
+  }
 
-    Ogre::Vector3 new_position = start->eye + relative_progress_in_space * (goal->eye - start->eye);
-    Ogre::Vector3 new_focus = start->focus + relative_progress_in_space * (goal->focus - start->focus);
-    Ogre::Vector3 new_up = start->up + relative_progress_in_space * (goal->up - start->up);
+  if(render_frame_by_frame_)
+    reportRenderRate(false);
+}
 
-    Ogre::Vector3 velocity = (new_position - eye_point_property_->getVector()) / ros_dt;
-    transition_velocity_property_->setFloat(velocity.normalise());
+void CinematographerViewController::reportRenderRate(bool is_finished)
+{
+  const double duration = (ros::WallTime::now() - render_start_time_).toSec();
+  const double render_rate = duration > 0.0 ? published_frames_counter_ / duration : 0.0;
+  render_rate_property_->setFloat(static_cast<float>(render_rate));
 
-    if(odometry_pub_.getNumSubscribers() != 0)
-      publishOdometry(new_position, velocity);
+  if(is_finished)
+    ROS_INFO_STREAM("Rendered " << published_frames_counter_ << " frames in " << duration << " s with "
+                    << render_rate << " fps - " << render_rate / target_fps_ << " times real time.");
+}
 
-    disconnectPositionProperties();
-    eye_point_property_->setVector(new_position);
-    focus_point_property_->setVector(new_focus);
-    up_vector_property_->setVector(new_up);
-    distance_property_->setFloat(getDistanceFromCameraToFocalPoint());
-    connectPositionProperties();
+void CinematographerViewController::update(float dt, float ros_dt)
+{
+  updateAttachedSceneNode();
+  credits_callback_queue_.callAvailable();
 
-    // This needs to happen so that the camera orientation will update properly when fixed_up_property == false
-    camera_->setFixedYawAxis(true, reference_orientation_ * up_vector_property_->getVector());
-    camera_->setDirection(reference_orientation_ * (focus_point_property_->getVector() - eye_point_property_->getVector()));
+  if(is_finishing_rendering_)
+    publishFinishedRenderingIfReceived();
 
-    publishCameraPose();
+  bool is_waiting_for_credits = isWaitingForCredits();
+  samplePoseTable();
 
-    if(render_frame_by_frame_ && image_pub_.getNumSubscribers() > 0)
-      publishViewImage();
+  // a resumed recording continues at its start frame - the frames before are already in the recorder's output
+  if(animate_ && render_frame_by_frame_ && frames_to_skip_ > 0)
+    skipFrames();
 
-    // if current movement is over
-    if(!animate_)
-    {
-      // delete current start element in buffer
-      cam_movements_buffer_.pop_front();
-      recorded_frames_counter_ = 0;
-
-      // if there are still movements to perform
-      if(cam_movements_buffer_.size() > 1)
-      {
-        // reset animate to perform the next movement
-        animate_ = true;
-        // update the transition start time with the duration the transition should have taken
-        transition_start_time_ += ros::WallDuration(cam_movements_buffer_.front().transition_duration.toSec());
-      }
-      else
-      {
-        // clean up
-        cam_movements_buffer_.clear();
-
-        // publish that the rendering is finished 
-        if(render_frame_by_frame_)
-        {
-          rviz_cinematographer_msgs::Finished finished;
-          finished.is_finished = true;
-          // wait a little so last image is send before this "finished"-message 
-          ros::WallRate r(1); r.sleep();
-          finished_rendering_trajectory_pub_.publish(finished);
-          render_frame_by_frame_ = false;
-        }
-      }
-    }
+  if(animate_ && !pose_table_.empty() && !is_waiting_for_credits)
+  {
+    if(render_frame_by_frame_ && is_rendering_offline_)
+      renderOffline();
+    else
+      animate(ros_dt);
   }
   else
     transition_velocity_property_->setFloat(0.f);
@@ -757,41 +984,172 @@ void CinematographerViewController::update(float dt, float ros_dt)
 
 void CinematographerViewController::publishViewImage()
 {
-  // wait for specified duration - e.g. if recorder is not fast enough
-  if(do_wait_)
-  {
-    ros::WallRate r(1.f / wait_duration_);
-    r.sleep();
-    do_wait_ = false;
-  }
+  Ogre::RenderTarget* render_target = renderRecordedFrame();
+  unsigned int height = render_target->getHeight();
+  unsigned int width = render_target->getWidth();
 
-  unsigned int height = context_->getViewManager()->getRenderPanel()->getRenderWindow()->getHeight();
-  unsigned int width = context_->getViewManager()->getRenderPanel()->getRenderWindow()->getWidth();
-
-  // create a PixelBox of the needed size to store the rendered image
   Ogre::PixelFormat format = Ogre::PF_BYTE_BGR;
   auto outBytesPerPixel = Ogre::PixelUtil::getNumElemBytes(format);
-  auto data = new unsigned char[width * height * outBytesPerPixel];
+
+  sensor_msgs::ImagePtr ros_image = acquireViewImage(width, height,
+                                                     static_cast<unsigned int>(width * outBytesPerPixel));
+  ros::Time stamp = ros::Time::now();
+
+  // read the rendered image directly into the message 
   Ogre::Box extents(0, 0, width, height);
-  Ogre::PixelBox pb(extents, format, data);
-  context_->getViewManager()->getRenderPanel()->getRenderWindow()->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
-
-  // convert the image in the PixelBox to a sensor_msgs::Image and publish
-  sensor_msgs::ImagePtr ros_image = sensor_msgs::ImagePtr(new sensor_msgs::Image());;
-  ros_image->header.frame_id = attached_frame_property_->getStdString();
-  ros_image->header.stamp = ros::Time::now();
-  ros_image->height = height;
-  ros_image->width = width;
-  ros_image->encoding = sensor_msgs::image_encodings::BGR8;
-  ros_image->is_bigendian = false;
-  ros_image->step = static_cast<unsigned int>(width * outBytesPerPixel);
-  size_t size = width * outBytesPerPixel * height;
-  ros_image->data.resize(size);
-  memcpy((char*)(&ros_image->data[0]), data, size);
-
-  image_pub_.publish(ros_image);
-
-  delete[] data;
+  Ogre::PixelBox pb(extents, format, ros_image->data.data());
+  render_target->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+
+  enqueueViewImage(ros_image, stamp, attached_frame_property_->getStdString());
+  published_frames_counter_++;
+}
+
+void CinematographerViewController::enqueueViewImage(const sensor_msgs::ImagePtr& image, const ros::Time& stamp,
+                                                     const std::string& frame_id)
+{
+  // a full queue means that publishing is slower than rendering - wait instead of dropping a recorded frame 
+  const size_t max_queued_images = 2;
+
+  boost::mutex::scoped_lock lock(view_image_mutex_);
+  while(view_image_queue_.size() >= max_queued_images && !is_shutting_down_)
+    view_image_condition_.wait(lock);
+
+  QueuedViewImage queued_image;
+  queued_image.image = image;
+  queued_image.stamp = stamp;
+  queued_image.frame_id = frame_id;
+  view_image_queue_.push_back(queued_image);
+  view_image_condition_.notify_all();
+}
+
+void CinematographerViewController::waitUntilViewImagesPublished()
+{
+  boost::mutex::scoped_lock lock(view_image_mutex_);
+  while((!view_image_queue_.empty() || is_publishing_view_image_) && !is_shutting_down_)
+    view_image_condition_.wait(lock);
+}
+
+void CinematographerViewController::publishViewImages()
+{
+  while(true)
+  {
+    QueuedViewImage queued_image;
+    {
+      boost::mutex::scoped_lock lock(view_image_mutex_);
+      while(view_image_queue_.empty() && !is_shutting_down_)
+        view_image_condition_.wait(lock);
+      if(is_shutting_down_)
+        return;
+
+      queued_image = view_image_queue_.front();
+      view_image_queue_.pop_front();
+      is_publishing_view_image_ = true;
+    }
+    view_image_condition_.notify_all();
+
+    // the recorder detects dropped images by gaps in the consecutive sequence numbers - roscpp overwrites them with
+    // its own consecutive numbers when publishing to other processes 
+    queued_image.image->header.seq = view_image_seq_++;
+    queued_image.image->header.stamp = queued_image.stamp;
+    queued_image.image->header.frame_id = queued_image.frame_id;
+    image_pub_.publish(queued_image.image);
+
+    // release the message before reporting it published, so that it is back in the pool 
+    queued_image.image.reset();
+    {
+      boost::mutex::scoped_lock lock(view_image_mutex_);
+      is_publishing_view_image_ = false;
+    }
+    view_image_condition_.notify_all();
+  }
+}
+
+sensor_msgs::ImagePtr CinematographerViewController::acquireViewImage(unsigned int width, unsigned int height,
+                                                                     unsigned int step)
+{
+  const size_t max_pooled_images = 4;
+
+  if(!view_image_pool_.empty() && (view_image_pool_.front()->width != width ||
+                                   view_image_pool_.front()->height != height ||
+                                   view_image_pool_.front()->step != step))
+    view_image_pool_.clear();
+
+  // a message that is only held by the pool was released by the publisher and all subscribers 
+  for(const sensor_msgs::ImagePtr& image : view_image_pool_)
+    if(image.unique())
+      return image;
+
+  sensor_msgs::ImagePtr image = boost::make_shared<sensor_msgs::Image>();
+  image->height = height;
+  image->width = width;
+  image->encoding = sensor_msgs::image_encodings::BGR8;
+  image->is_bigendian = false;
+  image->step = step;
+  image->data.resize(static_cast<size_t>(step) * height);
+
+  if(view_image_pool_.size() < max_pooled_images)
+    view_image_pool_.push_back(image);
+  return image;
+}
+
+Ogre::RenderTarget* CinematographerViewController::renderRecordedFrame()
+{
+  updateRenderTexture();
+  if(render_texture_.isNull())
+  {
+    Ogre::RenderWindow* render_window = context_->getViewManager()->getRenderPanel()->getRenderWindow();
+
+    // offline, the frames are rendered faster than rviz updates the window - render into its back buffer, which the 
+    // readback reads from, and leave swapping to rviz 
+    if(is_rendering_offline_)
+    {
+      updateCamera();
+      render_window->update(false);
+    }
+    return render_window;
+  }
+
+  // the camera is shared with the window - render with the aspect ratio of the texture and restore the window's
+  updateCamera();
+  Ogre::RenderTarget* render_target = render_texture_->getBuffer()->getRenderTarget();
+  const Ogre::Real window_aspect_ratio = camera_->getAspectRatio();
+  camera_->setAspectRatio(static_cast<Ogre::Real>(render_width_) / static_cast<Ogre::Real>(render_height_));
+  render_target->update();
+  camera_->setAspectRatio(window_aspect_ratio);
+
+  return render_target;
+}
+
+void CinematographerViewController::updateRenderTexture()
+{
+  if(!render_texture_.isNull() &&
+     render_texture_->getWidth() == render_width_ && render_texture_->getHeight() == render_height_)
+    return;
+
+  if(!render_texture_.isNull())
+  {
+    Ogre::TextureManager::getSingleton().remove(render_texture_->getHandle());
+    render_texture_.setNull();
+  }
+
+  if(render_width_ == 0 || render_height_ == 0)
+    return;
+
+  static int render_texture_count = 0;
+  UniformStringStream render_texture_name;
+  render_texture_name << "CinematographerRenderTexture" << render_texture_count++;
+
+  // only updated on demand, i.e. for the recorded frames - the window keeps rendering at its own size
+  render_texture_ = Ogre::TextureManager::getSingleton().createManual(
+    render_texture_name.str(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, Ogre::TEX_TYPE_2D,
+    render_width_, render_height_, 0, Ogre::PF_R8G8B8, Ogre::TU_RENDERTARGET);
+  Ogre::RenderTarget* render_target = render_texture_->getBuffer()->getRenderTarget();
+  render_target->setAutoUpdated(false);
+
+  Ogre::Viewport* viewport = render_target->addViewport(camera_);
+  viewport->setOverlaysEnabled(false);
+  viewport->setClearEveryFrame(true);
+  viewport->setBackgroundColour(context_->getViewManager()->getRenderPanel()->getViewport()->getBackgroundColour());
 }
 
 void CinematographerViewController::updateCamera()
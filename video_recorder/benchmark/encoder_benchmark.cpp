@@ -0,0 +1,115 @@
+/** @file
+ *
+ * Benchmark of the encode rate of the OpenCV and ffmpeg encoder backends at 1080p.
+ *
+ * @author Jan Razlaw
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "video_recorder/encoder_backend.h"
+
+using namespace video_recorder;
+
+/** @brief An encoder under test and the extension of its output file. */
+struct Candidate
+{
+  std::string label;
+  boost::shared_ptr<EncoderBackend> encoder;
+  std::string extension;
+};
+
+// Returns ffmpeg settings of the given codec and preset
+static FfmpegSettings ffmpegSettings(const std::string& codec, const std::string& preset)
+{
+  FfmpegSettings settings;
+  settings.codec = codec;
+  settings.preset = preset;
+  return settings;
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    std::printf("Usage: %s <output directory> [frames]\n", argv[0]);
+    return 1;
+  }
+
+  const std::string output_directory = argv[1];
+  const int num_frames = argc > 2 ? std::max(1, std::atoi(argv[2])) : 300;
+  const cv::Size size(1920, 1080);
+  const double fps = 30.0;
+
+  // a textured image that pans by a few pixels per frame, so that the encoders have to estimate motion - the frames
+  // are headers into it, so the frames are not copied before they are passed to the encoders
+  const int pan_step = 4;
+  const int num_pan_frames = 60;
+  cv::Mat background(size.height, size.width + pan_step * num_pan_frames, CV_8UC3);
+  cv::randu(background, cv::Scalar::all(0), cv::Scalar::all(256));
+  cv::GaussianBlur(background, background, cv::Size(0, 0), 3.0);
+
+  const int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  std::vector<Candidate> candidates = {
+    {"OpenCV DIVX", boost::make_shared<OpenCvEncoder>(cv::VideoWriter::fourcc('D', 'I', 'V', 'X')), ".avi"},
+    {"OpenCV PIM1", boost::make_shared<OpenCvEncoder>(cv::VideoWriter::fourcc('P', 'I', 'M', '1')), ".avi"},
+    {"ffmpeg libx264 ultrafast", boost::make_shared<FfmpegEncoder>(ffmpegSettings("libx264", "ultrafast")), ".mp4"},
+    {"ffmpeg libx264 veryfast", boost::make_shared<FfmpegEncoder>(ffmpegSettings("libx264", "veryfast")), ".mp4"},
+    {"ffmpeg libx264 medium", boost::make_shared<FfmpegEncoder>(ffmpegSettings("libx264", "medium")), ".mp4"},
+    {"ffmpeg libx265 ultrafast", boost::make_shared<FfmpegEncoder>(ffmpegSettings("libx265", "ultrafast")), ".mp4"},
+    {"ffmpeg ffv1 lossless", boost::make_shared<FfmpegEncoder>(losslessFfmpegSettings(num_threads)), ".mkv"}
+  };
+
+  std::printf("Encoding %d frames of %dx%d.\n", num_frames, size.width, size.height);
+  for(size_t i = 0; i < candidates.size(); ++i)
+  {
+    EncoderBackend& encoder = *candidates[i].encoder;
+    const std::string path = output_directory + "/encoder_benchmark_" + std::to_string(i) + candidates[i].extension;
+
+    // the time to finalize the file is part of the encode rate
+    auto start = std::chrono::steady_clock::now();
+    if(!encoder.open(path, fps, size))
+    {
+      std::printf("%s: could not open %s.\n", candidates[i].label.c_str(), path.c_str());
+      continue;
+    }
+
+    int written_frames = 0;
+    for(int frame = 0; frame < num_frames; ++frame)
+    {
+      const int pan = frame % (2 * num_pan_frames);
+      const int offset = pan_step * (pan < num_pan_frames ? pan : 2 * num_pan_frames - pan);
+      if(encoder.write(background(cv::Rect(offset, 0, size.width, size.height))))
+        written_frames++;
+    }
+    const bool is_finalized = encoder.release();
+    const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!is_finalized)
+    {
+      std::printf("%s: could not finalize %s.\n", candidates[i].label.c_str(), path.c_str());
+      continue;
+    }
+
+    struct stat output_stat;
+    const double megabytes = stat(path.c_str(), &output_stat) == 0 ? output_stat.st_size / 1e6 : 0.0;
+    std::printf("%s: %d frames in %.2f s - %.1f fps, %.1f MB\n", candidates[i].label.c_str(), written_frames,
+                duration, written_frames / duration, megabytes);
+  }
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/** @file
+ *
+ * Benchmark of the watermark blending at 1080p and 4K against the former per-pixel loop.
+ *
+ * @author Jan Razlaw
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "video_recorder/watermark_blender.h"
+
+using namespace video_recorder;
+
+// The blending of the recorder before the WatermarkBlender - the baseline of the benchmark
+static void addWatermarkPerPixel(cv::Mat& image, const cv::Mat& watermark)
+{
+  int origin_watermark_row = image.rows - watermark.rows;
+  int origin_watermark_col = image.cols - watermark.cols;
+  int image_row = origin_watermark_row;
+  int image_col = origin_watermark_col;
+  float alpha = 0.8f;
+  for(int watermark_row = 0; watermark_row < watermark.rows; watermark_row++, image_row++)
+  {
+    image_col = origin_watermark_col;
+    for(int watermark_col = 0; watermark_col < watermark.cols; watermark_col++, image_col++)
+    {
+      // overlay if pixel in watermark is not transparent
+      unsigned char pixel_alpha = watermark.at<cv::Vec4b>(watermark_row, watermark_col)[3];
+      if(pixel_alpha != 0)
+        for(int i = 0; i < 3; ++i)
+          image.at<cv::Vec3b>(image_row, image_col)[i] = cv::saturate_cast<uchar>(
+            alpha * image.at<cv::Vec3b>(image_row, image_col)[i] +
+            (1.f - alpha) * watermark.at<cv::Vec4b>(watermark_row, watermark_col)[i]);
+    }
+  }
+}
+
+// Returns the mean duration of a call of the function in milliseconds
+template<typename Function>
+static double measure(const Function& function, int iterations)
+{
+  function();
+
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i)
+    function();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    std::printf("Usage: %s <path to watermark.png> [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  cv::Mat original_watermark = cv::imread(argv[1], cv::IMREAD_UNCHANGED);
+  if(original_watermark.type() != CV_8UC4)
+  {
+    std::printf("Could not read a BGRA watermark from %s.\n", argv[1]);
+    return 1;
+  }
+  const int iterations = argc > 2 ? std::max(1, std::atoi(argv[2])) : 200;
+
+  std::printf("Blend kernel: %s\n", WatermarkBlender::kernelName());
+  const cv::Size sizes[] = {cv::Size(1920, 1080), cv::Size(3840, 2160)};
+  for(const cv::Size& size : sizes)
+  {
+    // the recorder shrinks the watermark to at most half the width of the video
+    cv::Mat watermark = original_watermark.clone();
+    float watermark_resize_factor = (0.5f * size.width) / watermark.cols;
+    if(watermark_resize_factor < 1.f)
+      cv::resize(watermark, watermark, cv::Size(), watermark_resize_factor, watermark_resize_factor);
+
+    cv::Mat frame(size, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(256));
+    WatermarkBlender blender(watermark);
+
+    // the blending does not depend on the pixel values, so the frames are blended repeatedly
+    cv::Mat per_pixel_frame = frame.clone();
+    cv::Mat blended_frame = frame.clone();
+    const double per_pixel_duration = measure([&]() { addWatermarkPerPixel(per_pixel_frame, watermark); }, iterations);
+    const double blender_duration = measure([&]() { blender.apply(blended_frame); }, iterations);
+
+    // both blend in the same weights, but the blender rounds the premultiplied watermark separately
+    per_pixel_frame = frame.clone();
+    blended_frame = frame.clone();
+    addWatermarkPerPixel(per_pixel_frame, watermark);
+    blender.apply(blended_frame);
+    const double max_difference = cv::norm(per_pixel_frame, blended_frame, cv::NORM_INF);
+
+    std::printf("%dx%d with a %dx%d watermark: per-pixel loop %.3f ms, blender %.3f ms, speedup %.1fx, "
+                "max difference %.0f\n", size.width, size.height, watermark.cols, watermark.rows, per_pixel_duration,
+                blender_duration, per_pixel_duration / blender_duration, max_difference);
+  }
+
+  return 0;
+}
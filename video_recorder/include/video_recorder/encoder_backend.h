@@ -0,0 +1,236 @@
+/** @file
+ *
+ * Encoder backends that write frames to a video file.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_ENCODER_BACKEND_H
+#define VIDEO_RECORDER_ENCODER_BACKEND_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio/videoio.hpp>
+
+namespace video_recorder
+{
+
+/** @brief Quotes the string so that the shell passes it as a single argument. */
+std::string shellQuote(const std::string& argument);
+
+/** @brief Returns the path without the extension of its file name. */
+std::string stripExtension(const std::string& path);
+
+/** @brief Interface of the encoders the recorder's writer stage feeds its frames to. */
+class EncoderBackend
+{
+public:
+
+  virtual ~EncoderBackend() {}
+
+  /** @brief Opens the output file.
+   *
+   * @param[in] path    path to the output file.
+   * @param[in] fps     frames per second of the video.
+   * @param[in] size    size of the frames passed to write() - yuv420p frames are 3/2 times as high as the picture.
+   * @return True if the output file could be opened.
+   */
+  virtual bool open(const std::string& path, double fps, const cv::Size& size) = 0;
+
+  virtual bool isOpened() const = 0;
+
+  /** @brief Selects the encoding of the frames passed to write() - bgr8 unless changed before open().
+   *
+   * Encoders that convert the frames into the colorspace of their codec anyway can take other channel orders without
+   * a conversion by the recorder, so that the frames are converted only once. Encoders of YUV 4:2:0 codecs may take
+   * yuv420p frames converted by the recorder's preprocessing workers - see YuvConverter.
+   *
+   * @param[in] encoding    the encoding, e.g. bgra8 or yuv420p.
+   * @return False if the encoder does not take frames of the encoding - they have to be converted to bgr8 then.
+   */
+  virtual bool setInputEncoding(const std::string& encoding) { return encoding == "bgr8"; }
+
+  /** @brief Encodes the frame - BGR unless another encoding was selected by setInputEncoding().
+   *
+   * @param[in] image   the frame - has to be of the size passed to open().
+   * @return False if the frame could not be written.
+   */
+  virtual bool write(const cv::Mat& image) = 0;
+
+  /** @brief Finalizes and closes the output file.
+   *
+   * @return False if the output could not be finalized, e.g. because the encoder failed - it may be missing or
+   *         incomplete then. True if nothing was opened.
+   */
+  virtual bool release() = 0;
+
+  /** @brief Returns true if write() keeps a copy of the frame, e.g. to encode it in another thread. */
+  virtual bool copiesFrames() const { return false; }
+
+  /** @brief Returns true if frames are encoded independently of each other by writeFrame().
+   *
+   * The recorder then encodes the frames in its preprocessing workers, i.e. in parallel and out of order.
+   */
+  virtual bool encodesInWorkers() const { return false; }
+
+  /** @brief Encodes the BGR frame with the given number - only used if encodesInWorkers() returns true.
+   *
+   * Has to be thread-safe.
+   *
+   * @param[in] image           the frame.
+   * @param[in] frame_number    index of the frame within the recording.
+   * @return False if the frame could not be written.
+   */
+  virtual bool writeFrame(const cv::Mat& image, uint64_t frame_number) { return false; }
+
+  /** @brief Returns true if writeDuplicate() can repeat the last frame without its image data. */
+  virtual bool canWriteDuplicates() const { return false; }
+
+  /** @brief Repeats the last written frame as the frame with the given number - only used if canWriteDuplicates().
+   *
+   * @param[in] frame_number    index of the repeated frame within the recording.
+   * @return False if the frame could not be written.
+   */
+  virtual bool writeDuplicate(uint64_t frame_number) { return false; }
+
+  /** @brief Returns a human readable name of the backend for log messages. */
+  virtual std::string name() const = 0;
+};
+
+/** @brief Writes frames with OpenCV's cv::VideoWriter. */
+class OpenCvEncoder : public EncoderBackend
+{
+public:
+
+  /** @brief Constructor.
+   *
+   * @param[in] codec   fourcc code of the codec.
+   */
+  explicit OpenCvEncoder(int codec);
+
+  bool open(const std::string& path, double fps, const cv::Size& size) override;
+  bool isOpened() const override;
+  bool write(const cv::Mat& image) override;
+  bool release() override;
+  std::string name() const override;
+
+protected:
+
+  cv::VideoWriter video_writer_;
+  int codec_;
+};
+
+/** @brief Settings of the ffmpeg encoder - empty strings, a negative crf and non-positive counts keep the defaults. */
+struct FfmpegSettings
+{
+  FfmpegSettings()
+    : executable("ffmpeg")
+      , codec("libx264")
+      , pixel_format("yuv420p")
+      , crf(-1)
+      , threads(0)
+      , slices(0)
+  {
+  }
+
+  std::string executable;     ///< Name or path of the ffmpeg executable.
+  std::string codec;          ///< Video codec, e.g. libx264, libx265 or ffv1.
+  std::string preset;         ///< Encoder preset, e.g. ultrafast or medium.
+  std::string pixel_format;   ///< Pixel format of the encoded video, e.g. yuv420p.
+  int crf;                    ///< Constant rate factor.
+  int threads;                ///< Number of encoder threads.
+  int slices;                 ///< Number of slices encoded in parallel - for slice-threaded codecs like ffv1.
+  std::vector<std::string> codec_options;   ///< Additional output options passed to ffmpeg as is.
+};
+
+/** @brief Returns the settings of a lossless ffv1 encoder that encodes slices on all cores.
+ *
+ * @param[in] num_threads   number of encoder threads.
+ */
+FfmpegSettings losslessFfmpegSettings(int num_threads);
+
+/** @brief Streams raw frames over a pipe into an ffmpeg process.
+ *
+ * Gives access to the codecs, presets, quality and threading options of ffmpeg, e.g. multi-threaded x264. The frames
+ * are piped in their input encoding - BGR, RGB, BGRA or RGBA - and ffmpeg's vectorized scaler folds the channel
+ * swizzle into the conversion to the pixel format of the codec, e.g. YUV 4:2:0. Frames that were already converted
+ * to YUV 4:2:0 by the recorder are piped as they are, which also halves the bytes passed through the pipe.
+ */
+class FfmpegEncoder : public EncoderBackend
+{
+public:
+
+  explicit FfmpegEncoder(const FfmpegSettings& settings);
+  virtual ~FfmpegEncoder();
+
+  bool open(const std::string& path, double fps, const cv::Size& size) override;
+  bool isOpened() const override;
+  bool write(const cv::Mat& image) override;
+  bool release() override;
+  std::string name() const override;
+
+  /** @brief Takes bgr8, rgb8, bgra8 and rgba8 frames and yuv420p frames if the codec's pixel format is yuv420p. */
+  bool setInputEncoding(const std::string& encoding) override;
+
+  /** @brief Returns the command line that starts ffmpeg for the given output. */
+  std::string buildCommand(const std::string& path, double fps, const cv::Size& size) const;
+
+protected:
+
+  FfmpegSettings settings_;
+  FILE* pipe_;
+  cv::Size size_;
+  std::string input_pixel_format_;    ///< ffmpeg's name of the pixel format of the piped frames.
+  int input_type_;                    ///< OpenCV type of the piped frames.
+};
+
+/** @brief Writes every frame into a separate PNG, TIFF or raw file.
+ *
+ * The files are named after the output path without its extension followed by the zero-padded frame number, e.g.
+ * video_000042.png for the output path video.avi. Raw files contain the rows of BGR pixels without a header.
+ */
+class ImageSequenceEncoder : public EncoderBackend
+{
+public:
+
+  /** @brief Constructor.
+   *
+   * @param[in] format                  file format - png, tiff or raw.
+   * @param[in] png_compression_level   compression level of PNG files from 0 (none) to 9 (smallest).
+   * @param[in] num_digits              number of digits of the frame numbers.
+   */
+  ImageSequenceEncoder(const std::string& format, int png_compression_level, int num_digits = 6);
+
+  bool open(const std::string& path, double fps, const cv::Size& size) override;
+  bool isOpened() const override;
+  bool write(const cv::Mat& image) override;
+  bool release() override;
+  std::string name() const override;
+  bool encodesInWorkers() const override { return true; }
+  bool writeFrame(const cv::Mat& image, uint64_t frame_number) override;
+  bool canWriteDuplicates() const override { return true; }
+
+  /** @brief Links the file of the previous frame instead of compressing the image again. */
+  bool writeDuplicate(uint64_t frame_number) override;
+
+  /** @brief Returns the path of the file the frame with the given number is written to. */
+  std::string framePath(uint64_t frame_number) const;
+
+protected:
+
+  std::string format_;
+  std::vector<int> write_params_;
+  int num_digits_;
+  std::string path_prefix_;
+  std::atomic<bool> is_opened_;
+  uint64_t next_frame_number_;  ///< Number of the next frame passed to write().
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_ENCODER_BACKEND_H
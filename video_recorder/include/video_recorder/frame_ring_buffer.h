@@ -0,0 +1,222 @@
+/** @file
+ *
+ * Lock-free ring of preallocated frames passed through the recording pipeline.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_FRAME_RING_BUFFER_H
+#define VIDEO_RECORDER_FRAME_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ros/time.h>
+
+#include <opencv2/core/core.hpp>
+
+namespace video_recorder
+{
+
+/** @brief A preallocated slot of the FrameRingBuffer.
+ *
+ * All images are allocated on first use and reused for every following frame of the same resolution. The writer may
+ * swap the buffers of the last written frame with the ones it kept from an earlier frame instead of copying them.
+ */
+struct Frame
+{
+  Frame()
+    : num_bytes(0)
+      , sequence_number(0)
+      , frame_number(0)
+      , is_duplicate(false)
+      , is_encoded(false)
+      , encode_duration(0.0)
+      , conversion_duration(0.0)
+      , watermark_duration(0.0)
+      , is_preprocessed(false)
+  {
+  }
+
+  cv::Mat image;                      ///< Image as received, allocated once when the ring is sized.
+  std::string encoding;               ///< Encoding of image.
+  cv::Mat converted;                  ///< Scratch image for the color conversion to BGR.
+  cv::Mat resized;                    ///< Scratch image for resizing to the output size.
+  cv::Mat output;                     ///< Header of the image that is handed to the video writer.
+  std::vector<cv::Mat> renditions;    ///< Headers of the images that are handed to the writers of the renditions.
+  std::vector<cv::Mat> downscaled;    ///< Scratch images for downscaling to the sizes of the renditions.
+  cv::Mat yuv;                        ///< Scratch image for the conversion of the output to YUV 4:2:0.
+  std::vector<cv::Mat> yuv_renditions;  ///< Scratch images for the conversion of the renditions to YUV 4:2:0.
+  size_t num_bytes;                   ///< Memory held by the frame's images while it is in the pipeline.
+
+  uint64_t sequence_number;           ///< Index of the frame within the image stream.
+  uint64_t frame_number;              ///< Index of the frame within the current recording.
+  bool is_duplicate;                  ///< True if the image equals the previous one - image is not filled then.
+  bool is_encoded;                    ///< True if the frame was already encoded by a preprocessing worker.
+  double encode_duration;             ///< Duration of encoding the frame in a preprocessing worker in seconds.
+  double conversion_duration;         ///< Duration of the color conversion and resizing in seconds.
+  double watermark_duration;          ///< Duration of adding the watermark in seconds.
+  ros::WallTime arrival_time;         ///< Time the image was received by the recorder.
+  std::atomic<bool> is_preprocessed;  ///< True if output is ready to be written.
+};
+
+/** @brief Ring of preallocated frames that are passed from one producer to several workers and one consumer.
+ *
+ * The producer acquires the slot at the head, fills it and commits it. Workers claim committed slots in order, process
+ * them in place and may finish in any order. The consumer acquires the slot at the tail, i.e. always the oldest frame,
+ * and releases it once it is done with it. Nobody locks or allocates while the resolution stays the same.
+ * The slots are (re-)allocated by the producer and only while the ring is empty.
+ */
+class FrameRingBuffer
+{
+public:
+
+  FrameRingBuffer()
+    : capacity_(0)
+      , image_type_(-1)
+      , head_(0)
+      , claimed_(0)
+      , tail_(0)
+  {
+  }
+
+  /** @brief Allocates capacity slots for images of the given size and type. Producer only.
+   *
+   * @param[in] capacity    number of slots.
+   * @param[in] size        size of the images.
+   * @param[in] type        OpenCV type of the images.
+   * @return False if the ring still contains frames, true otherwise.
+   */
+  bool allocate(size_t capacity, const cv::Size& size, int type)
+  {
+    if(!empty() || capacity == 0)
+      return false;
+
+    slots_.reset(new Frame[capacity]);
+    for(size_t i = 0; i < capacity; ++i)
+      slots_[i].image.create(size, type);
+
+    capacity_.store(capacity, std::memory_order_release);
+    image_size_ = size;
+    image_type_ = type;
+    return true;
+  }
+
+  /** @brief Returns true if the slots are allocated for images of the given size and type. Producer only. */
+  bool isAllocatedFor(const cv::Size& size, int type) const
+  {
+    return capacity_ > 0 && size == image_size_ && type == image_type_;
+  }
+
+  /** @brief Returns the slot at the head or nullptr if the ring is full. Producer only. */
+  Frame* acquireWriteSlot()
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head - tail_.load(std::memory_order_acquire) >= capacity_)
+      return nullptr;
+
+    Frame* frame = &slots_[head % capacity_];
+    frame->sequence_number = head;
+    return frame;
+  }
+
+  /** @brief Publishes the slot returned by acquireWriteSlot() to the workers and the consumer. Producer only. */
+  void commitWriteSlot()
+  {
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /** @brief Claims the oldest committed slot that was not claimed yet. Thread-safe for any number of workers.
+   *
+   * @param[in] max_in_flight   maximum number of claimed slots that are not released by the consumer yet.
+   * @return The claimed slot or nullptr if there is nothing to claim or max_in_flight is reached.
+   */
+  Frame* claimSlot(size_t max_in_flight)
+  {
+    size_t claimed = claimed_.load(std::memory_order_acquire);
+    do
+    {
+      if(claimed == head_.load(std::memory_order_acquire) ||
+         claimed - tail_.load(std::memory_order_acquire) >= max_in_flight)
+        return nullptr;
+    }
+    while(!claimed_.compare_exchange_weak(claimed, claimed + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    // a claimed slot is not released before it is processed, so the ring can not be reallocated in between
+    return &slots_[claimed % capacity_];
+  }
+
+  /** @brief Returns true if claimSlot() would currently succeed. */
+  bool hasClaimableSlot(size_t max_in_flight) const
+  {
+    size_t claimed = claimed_.load(std::memory_order_acquire);
+    return claimed != head_.load(std::memory_order_acquire) &&
+           claimed - tail_.load(std::memory_order_acquire) < max_in_flight;
+  }
+
+  /** @brief Returns the slot at the tail or nullptr if the ring is empty. Consumer only. */
+  Frame* acquireReadSlot()
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if(head_.load(std::memory_order_acquire) == tail)
+      return nullptr;
+    return &slots_[tail % capacity_];
+  }
+
+  /** @brief Returns the committed slot offset slots behind the tail or nullptr if it is not committed yet.
+   * Consumer only.
+   */
+  Frame* peekReadSlot(size_t offset)
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if(head_.load(std::memory_order_acquire) - tail <= offset)
+      return nullptr;
+    return &slots_[(tail + offset) % capacity_];
+  }
+
+  /** @brief Hands the slot returned by acquireReadSlot() back to the producer. Consumer only. */
+  void releaseReadSlot()
+  {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /** @brief Returns the number of frames that were committed but not yet released. */
+  size_t size() const
+  {
+    // load tail first so that it can never be ahead of the loaded head
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return head_.load(std::memory_order_acquire) - tail;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /** @brief Returns the number of slots or zero if the ring is not allocated yet. */
+  size_t capacity() const { return capacity_.load(std::memory_order_acquire); }
+
+  /** @brief Returns the number of slots that can be filled without blocking. */
+  size_t freeSlots() const
+  {
+    size_t capacity = this->capacity();
+    size_t size = this->size();
+    return capacity > size ? capacity - size : 0;
+  }
+
+protected:
+
+  std::unique_ptr<Frame[]> slots_;
+  std::atomic<size_t> capacity_;
+  cv::Size image_size_;
+  int image_type_;
+
+  std::atomic<size_t> head_;      ///< Number of frames committed by the producer so far.
+  std::atomic<size_t> claimed_;   ///< Number of frames claimed by workers so far.
+  std::atomic<size_t> tail_;      ///< Number of frames released by the consumer so far.
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_FRAME_RING_BUFFER_H
@@ -0,0 +1,107 @@
+/** @file
+ *
+ * Per-frame durations of the recording pipeline aggregated into metrics.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_FRAME_STATISTICS_H
+#define VIDEO_RECORDER_FRAME_STATISTICS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <rviz_cinematographer_msgs/RecorderMetrics.h>
+
+namespace video_recorder
+{
+
+/** @brief Accumulates the durations of written frames - not thread-safe. */
+class FrameStatistics
+{
+public:
+
+  FrameStatistics()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    num_frames_ = 0;
+    conversion_duration_sum_ = 0.0;
+    watermark_duration_sum_ = 0.0;
+    encode_duration_sum_ = 0.0;
+    encode_duration_max_ = 0.0;
+    arrival_to_write_durations_.clear();
+  }
+
+  /** @brief Adds the durations of a written frame in seconds. */
+  void add(double conversion_duration, double watermark_duration, double encode_duration,
+           double arrival_to_write_duration)
+  {
+    num_frames_++;
+    conversion_duration_sum_ += conversion_duration;
+    watermark_duration_sum_ += watermark_duration;
+    encode_duration_sum_ += encode_duration;
+    encode_duration_max_ = std::max(encode_duration_max_, encode_duration);
+    arrival_to_write_durations_.push_back(arrival_to_write_duration);
+  }
+
+  uint64_t numFrames() const { return num_frames_; }
+
+  double encodeDurationSum() const { return encode_duration_sum_; }
+
+  /** @brief Returns the given percentile of the durations from image arrival to encode start.
+   *
+   * @param[in] percentile  the percentile in [0, 1].
+   */
+  double arrivalToWriteDuration(double percentile)
+  {
+    if(arrival_to_write_durations_.empty())
+      return 0.0;
+
+    size_t index = std::min(arrival_to_write_durations_.size() - 1,
+                            static_cast<size_t>(percentile * arrival_to_write_durations_.size()));
+    std::nth_element(arrival_to_write_durations_.begin(), arrival_to_write_durations_.begin() + index,
+                     arrival_to_write_durations_.end());
+    return arrival_to_write_durations_[index];
+  }
+
+  /** @brief Fills the durations, percentiles and frame rate of the metrics message.
+   *
+   * @param[out]    metrics     the message.
+   * @param[in]     duration    the duration the statistics were aggregated over in seconds.
+   */
+  void fill(rviz_cinematographer_msgs::RecorderMetrics& metrics, double duration)
+  {
+    metrics.duration = duration;
+    metrics.written_frames = num_frames_;
+    metrics.fps = duration > 0.0 ? num_frames_ / duration : 0.0;
+    if(num_frames_ == 0)
+      return;
+
+    metrics.mean_conversion_duration = conversion_duration_sum_ / num_frames_;
+    metrics.mean_watermark_duration = watermark_duration_sum_ / num_frames_;
+    metrics.mean_encode_duration = encode_duration_sum_ / num_frames_;
+    metrics.max_encode_duration = encode_duration_max_;
+    metrics.latency_p50 = arrivalToWriteDuration(0.5);
+    metrics.latency_p90 = arrivalToWriteDuration(0.9);
+    metrics.latency_p99 = arrivalToWriteDuration(0.99);
+    metrics.latency_max = arrivalToWriteDuration(1.0);
+  }
+
+protected:
+
+  uint64_t num_frames_;
+  double conversion_duration_sum_;
+  double watermark_duration_sum_;
+  double encode_duration_sum_;
+  double encode_duration_max_;
+  std::vector<double> arrival_to_write_durations_;
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_FRAME_STATISTICS_H
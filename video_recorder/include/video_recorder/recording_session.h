@@ -0,0 +1,337 @@
+/** @file
+ *
+ * Records the images of one image stream into a video.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_RECORDING_SESSION_H
+#define VIDEO_RECORDER_RECORDING_SESSION_H
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <ros/callback_queue.h>
+
+#include <rviz_cinematographer_msgs/Record.h>
+#include <rviz_cinematographer_msgs/Finished.h>
+#include <rviz_cinematographer_msgs/Credits.h>
+#include <rviz_cinematographer_msgs/RecorderMetrics.h>
+#include <rviz_cinematographer_msgs/RecordingFinalized.h>
+
+#include <sensor_msgs/Image.h>
+
+#include <boost/thread.hpp>
+#include <boost/make_shared.hpp>
+
+#include <cv.hpp>
+
+#include <image_transport/image_transport.h>
+#include <cv_bridge/cv_bridge.h>
+
+#include "video_recorder/encoder_backend.h"
+#include "video_recorder/frame_ring_buffer.h"
+#include "video_recorder/frame_statistics.h"
+#include "video_recorder/segmented_encoder.h"
+#include "video_recorder/spill_file.h"
+#include "video_recorder/watermark_blender.h"
+#include "video_recorder/worker_pool.h"
+#include "video_recorder/yuv_converter.h"
+
+namespace video_recorder
+{
+
+/** @brief An additional output of the recording with its own size, encoder and watermark setting. */
+struct Rendition
+{
+  cv::Size size;                  ///< Requested size - zero dimensions are derived from the main output's size.
+  bool add_watermark;
+  std::string path_to_output;
+  boost::shared_ptr<EncoderBackend> encoder;
+};
+
+/** @brief Records one image stream with its own topics, settings, buffers and encoders.
+ *
+ * The callbacks of a session are processed by its own spinner thread, so that a session that blocks on a full
+ * pipeline does not stall the others. The preprocessing stage runs as tasks on the worker pool shared by all sessions.
+ */
+class RecordingSession : public WorkerPoolClient
+{
+public:
+
+  /** @brief Reads the settings, subscribes to the topics of the session and starts its threads.
+   *
+   * @params[in] name           name of the session - used as logger name.
+   * @params[in] topic_prefix   prefix of the topics of the session, e.g. "/camera_1" - empty for the default topics.
+   *                            Also appended to the spill path, so that the sessions don't share the spill file.
+   * @params[in] private_nh     node handle of the recorder's parameters.
+   * @params[in] session_nh     node handle of the session's parameters - they override the recorder's parameters.
+   * @params[in] worker_pool    the pool that runs the preprocessing stage.
+   */
+  RecordingSession(const std::string& name, const std::string& topic_prefix, const ros::NodeHandle& private_nh,
+                   const ros::NodeHandle& session_nh, const boost::shared_ptr<WorkerPool>& worker_pool);
+  virtual ~RecordingSession();
+
+  const std::string& name() const { return name_; }
+
+  bool hasTask() override;
+
+  /** @brief Returns the number of bytes of a frame, so that the pool shares the workers by processed bytes. */
+  size_t taskCost() override;
+
+  /** @brief Preprocessing stage - converts, resizes and watermarks a claimed frame in place.
+   *
+   * Frames are processed out of order by the workers of the pool. Encoders that encode each frame independently, e.g.
+   * image sequences, are fed by these workers as well.
+   */
+  bool runTask() override;
+
+protected:
+
+  /** @brief Sets requested recording parameters.
+   *
+   * If the previous recording is still draining, the parameters are queued and applied by the finalize thread once
+   * its encoders are detached, so that the callback thread is not blocked. A newer request replaces a queued one.
+   *
+   * @params[in] record_params  specifies that a record should be made and the parameters that should be used.
+   */
+  void recordParamsCallback(const rviz_cinematographer_msgs::Record::ConstPtr& record_params);
+
+  /** @brief Creates the encoders of the requested recording and resets the statistics and credits.
+   *
+   * The encoder is only replaced if no recording is in progress. Has to be called with record_params_mutex_ locked.
+   *
+   * @params[in] record_params  specifies that a record should be made and the parameters that should be used.
+   */
+  void applyRecordParams(const rviz_cinematographer_msgs::Record::ConstPtr& record_params);
+
+  /** @brief Awaits a message indicating that the image stream ended to stop recording.
+   *
+   * Hands the recording to the finalize thread without blocking.
+   *
+   * @params[in] rendering_finished  true if image stream ended.
+   */
+  void renderingFinishedCallback(const rviz_cinematographer_msgs::Finished::ConstPtr& rendering_finished);
+
+  /** @brief Finalize stage - closes the outputs of finished recordings in the background.
+   *
+   * Waits until the frames of a finished recording are written, detaches its encoders and publishes that the
+   * recording is finished, so that the next recording can start - queued record parameters are applied then. Then
+   * releases the encoders and publishes the summary and the finalized output.
+   */
+  void finalizeRecordings();
+
+  /** @brief Copies subscribed images into the ring buffer and publishes the remaining credits.
+   *
+   * Images are shared with the publisher instead of copied if possible - if the publisher runs in the same process,
+   * the copy into the ring buffer is the only copy of the image made on the way from the publisher to the encoder.
+   *
+   * The ring is sized from the first image's resolution so that the frames fit into the memory budget. The source of
+   * the image stream should only send images as long as it has credits. If the ring is full, images are spilled to
+   * the spill file on disk until the ring has room again. If the spill file is full or disabled as well, the callback
+   * blocks until a slot is released instead of dropping the image.
+   *
+   * Images that are equal to the previous image are marked as duplicates. A hash over sampled rows filters candidates
+   * that are then compared pixel by pixel with the previous image, which is kept by sharing its message. Duplicates
+   * are neither copied nor preprocessed and the writer stage repeats the previous frame instead.
+   *
+   * @params[in] input_image  subscribed image.
+   */
+  void imageCallback(const sensor_msgs::ImageConstPtr& input_image);
+
+  /** @brief Moves spilled frames from the spill file back into the ring buffer in order, once slots are released. */
+  void refillImages();
+
+  /** @brief Writer stage - feeds preprocessed frames to the encoder in the order they were received. */
+  void writeImages();
+
+  /** @brief Converts the received image to BGR, resizes it to the output size and adds the watermark if requested.
+   *
+   * The renditions are downscaled from the converted image as a pyramid, i.e. each rendition from the smallest larger
+   * image computed before, so that the received image is only converted once.
+   *
+   * @params[in,out]    frame   the frame being processed.
+   */
+  void preprocessImage(Frame& frame);
+
+  /** @brief Encodes the preprocessed frame in the calling worker thread if the encoder supports it.
+   *
+   * @params[in,out]    frame   the preprocessed frame.
+   */
+  void encodeInWorker(Frame& frame);
+
+  /** @brief Returns the blender of the watermark resized to fit images of the given width and encoding.
+   *
+   * The watermark is only resized and its blend table only computed once per recording, image width and encoding.
+   *
+   * @params[in]        image_width     the width of the watermarked images.
+   * @params[in]        encoding        the encoding of the watermarked images - bgr8, rgb8, bgra8 or rgba8.
+   */
+  boost::shared_ptr<const WatermarkBlender> getWatermarkBlender(const int image_width, const std::string& encoding);
+
+  /** @brief Creates the encoder requested by the record parameters.
+   *
+   * @params[in] record_params  the record parameters.
+   * @return The encoder or a null pointer if the requested encoder is unknown.
+   */
+  boost::shared_ptr<EncoderBackend> createEncoder(const rviz_cinematographer_msgs::Record& record_params) const;
+
+  /** @brief Advertises the number of free slots in the ring buffer and the number of received frames.
+   *
+   * The source of the image stream may send as many images as there are free slots minus the images that it sent
+   * but that were not received yet.
+   */
+  void publishCredits();
+
+  /** @brief Publishes the metrics aggregated since the last call and resets them. Called at metrics_rate. */
+  void publishMetrics(const ros::WallTimerEvent& event);
+
+  /** @brief Returns the metrics message filled from the statistics and the current state of the pipeline.
+   *
+   * Has to be called while the pipeline mutex is locked.
+   *
+   * @params[in]    statistics  the statistics of the written frames.
+   * @params[in]    duration    the duration the statistics were aggregated over in seconds.
+   */
+  rviz_cinematographer_msgs::RecorderMetrics collectMetrics(FrameStatistics& statistics, double duration);
+
+  /** @brief Selects the encoding of the frames passed to the encoders and sets it at the encoders.
+   *
+   * YUV 4:2:0 converted by the preprocessing workers is preferred, then the received encoding and finally bgr8.
+   * Has to be called while the pipeline mutex is locked.
+   *
+   * @params[in]    encoding    the encoding of the received images.
+   * @params[in]    image_size  the size of the received images.
+   * @return The encoding all encoders take.
+   */
+  std::string selectOutputEncoding(const std::string& encoding, const cv::Size& image_size);
+
+  /** @brief Returns the number of bytes a frame occupies in the pipeline including its scratch images.
+   *
+   * @params[in]    image       the received image.
+   * @params[in]    encoding    the encoding of the received image.
+   * @params[in]    renditions  the additional renditions of the recording.
+   */
+  size_t computeFrameFootprint(const cv::Mat& image, const std::string& encoding,
+                               const std::vector<Rendition>& renditions) const;
+
+  /** @brief Returns the renditions of the current recording. */
+  boost::shared_ptr<const std::vector<Rendition> > getRenditions();
+
+  /** @brief Wakes up all threads waiting for the given condition.
+   *
+   * The pipeline mutex is acquired before notifying, so that a thread can not miss the notification between checking
+   * the lock-free ring buffer and starting to wait.
+   *
+   * @params[in]    condition   the condition to notify.
+   */
+  void notify(boost::condition_variable& condition);
+
+  /** @brief Blocks until all frames in the ring buffer and the spill file are written.
+   *
+   * @return False if the session is shutting down.
+   */
+  bool waitUntilDrained();
+
+  /** @brief Resizes watermark to be at most half as wide as the input images.
+   *
+   * @params[in,out]    watermark       the watermark being resized.
+   * @params[in]        image_width     the width of the input images.
+   */
+  void resizeWatermark(cv::Mat& watermark, const int image_width);
+
+protected:
+
+  std::string name_;
+  ros::CallbackQueue callback_queue_;   ///< Queue of the session's callbacks - processed by spinner_.
+  ros::NodeHandle nh_;
+  boost::shared_ptr<ros::AsyncSpinner> spinner_;
+  boost::shared_ptr<WorkerPool> worker_pool_;
+
+  ros::Subscriber record_params_sub_;
+  ros::Subscriber rendering_finished_sub_;
+
+  image_transport::Subscriber image_sub_;
+  FrameRingBuffer image_ring_;
+  double memory_budget_;                ///< Maximum number of bytes held by frames in the pipeline.
+  double spill_budget_;                 ///< Maximum number of bytes of the spill file - zero disables spilling.
+  std::string spill_path_;
+  SpillFile spill_file_;                ///< Takes the frames that don't fit into the ring buffer.
+  boost::mutex producer_mutex_;         ///< Serializes the image callback and the refill thread filling the ring.
+  std::atomic<size_t> frame_footprint_; ///< Number of bytes a frame of the current resolution occupies.
+  std::atomic<uint64_t> bytes_in_flight_; ///< Number of bytes held by frames that are not written yet.
+  int max_preprocessed_frames_;         ///< Maximum number of frames in preprocessing or waiting to be written.
+  cv::Size output_size_;                ///< Size of the recorded video - empty to keep the size of the input images.
+
+  std::atomic<uint64_t> received_frames_counter_;   ///< Number of frames received during the current recording.
+  std::atomic<uint64_t> lost_frames_counter_;       ///< Number of frames of the current recording never received.
+  std::atomic<uint64_t> ring_copies_counter_;       ///< Number of frames copied into the ring buffer.
+  std::atomic<uint64_t> spill_copies_counter_;      ///< Number of frames copied into and out of the spill file.
+  std::atomic<uint64_t> segment_copies_counter_;    ///< Number of frames copied into the queues of segments.
+  std::atomic<uint64_t> retained_copies_counter_;   ///< Number of frames copied to repeat them for duplicates.
+  std::atomic<uint64_t> conversion_copies_counter_; ///< Number of frames converted on arrival.
+  std::atomic<uint64_t> duplicate_frames_counter_;  ///< Number of duplicate frames during the current recording.
+
+  bool has_image_seq_;                  ///< True if an image was received.
+  uint32_t last_image_seq_;             ///< Sequence number of the previously received image.
+  int duplicate_detection_row_step_;    ///< Every n-th row is hashed to detect duplicate frames - zero disables it.
+  uint64_t last_frame_hash_;            ///< Hash of the previously received image.
+  cv_bridge::CvImageConstPtr last_image_; ///< Previously received image - shares the message instead of copying it.
+  cv::Mat last_output_;                 ///< Last written frame for encoders that can't repeat frames - taken over from
+                                        ///< the slot by swapping buffers.
+  std::vector<cv::Mat> last_renditions_;  ///< Renditions of the last written frame - taken over like last_output_.
+
+  boost::mutex pipeline_mutex_;
+  boost::condition_variable frame_preprocessed_condition_;  ///< Notified if a frame is ready to be written.
+  boost::condition_variable frame_released_condition_;      ///< Notified if a slot in the ring buffer is released.
+  boost::condition_variable frame_spilled_condition_;       ///< Notified if spilled frames may be moved to the ring.
+  bool is_shutting_down_;
+  int num_pending_finalizations_;           ///< Number of finished recordings whose encoders are not detached yet.
+  boost::condition_variable finalize_condition_;  ///< Notified if a recording finished.
+  boost::mutex record_params_mutex_;        ///< Serializes applying record parameters in their order of arrival.
+  rviz_cinematographer_msgs::Record::ConstPtr pending_record_params_;  ///< Parameters waiting for a finalization.
+  std::atomic<uint32_t> recording_id_;      ///< Id of the current recording - echoed in the credits.
+
+  uint64_t encoded_bytes_;                  ///< Number of bytes of the uncompressed frames fed to the encoder.
+  FrameStatistics recording_statistics_;    ///< Statistics of the frames written during the current recording.
+  FrameStatistics period_statistics_;       ///< Statistics of the frames written since the last published metrics.
+  ros::WallTime period_start_time_;
+  ros::WallTime first_arrival_time_;        ///< Arrival time of the first frame of the current recording.
+  double metrics_rate_;                     ///< Rate the metrics are published at - zero to only publish summaries.
+  ros::WallTimer metrics_timer_;
+
+  boost::shared_ptr<boost::thread> write_images_thread_;
+  boost::shared_ptr<boost::thread> refill_images_thread_;
+  boost::shared_ptr<boost::thread> finalize_thread_;
+
+  ros::Publisher record_finished_pub_;
+  ros::Publisher credits_pub_;
+  ros::Publisher metrics_pub_;
+  ros::Publisher recording_finalized_pub_;
+
+  boost::shared_ptr<EncoderBackend> encoder_;   ///< Encoder of the current recording.
+  boost::shared_ptr<const std::vector<Rendition> > renditions_;   ///< Additional outputs of the current recording.
+  FfmpegSettings default_ffmpeg_settings_;
+  int max_parallel_segments_;               ///< Maximum number of segments encoded at the same time.
+  double segment_memory_budget_;            ///< Maximum number of bytes of the frames queued for the segments.
+  std::string path_to_output_;
+  int target_fps_;
+  std::atomic<uint64_t> frame_number_offset_;       ///< Index of the first frame, e.g. of a resumed recording.
+  std::string output_encoding_;             ///< Encoding of the frames passed to the encoders.
+  std::atomic<bool> add_watermark_;
+  boost::mutex watermark_mutex_;
+  cv::Mat original_watermark_;
+  /// Blenders by image width and encoding.
+  std::map<std::pair<int, std::string>, boost::shared_ptr<const WatermarkBlender> > watermark_blenders_;
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_RECORDING_SESSION_H
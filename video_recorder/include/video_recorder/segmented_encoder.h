@@ -0,0 +1,151 @@
+/** @file
+ *
+ * Encoder that cuts the video into segments which are encoded concurrently and concatenated afterwards.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_SEGMENTED_ENCODER_H
+#define VIDEO_RECORDER_SEGMENTED_ENCODER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "video_recorder/encoder_backend.h"
+
+namespace video_recorder
+{
+
+/** @brief Encodes segments of segment_length frames on separate encoder instances in parallel.
+ *
+ * Every segment is written into its own file by its own encoder and thread, so every segment starts with a key frame.
+ * Frames are copied into the queue of the current segment, reusing the buffers of encoded frames, so that the queued
+ * frames and the kept buffers together stay within max_queued_bytes. Once the segment is complete, the next segment
+ * starts while the previous ones are still encoding their queued frames. On release(), the segment files are
+ * concatenated into the output file by ffmpeg without re-encoding.
+ *
+ * Finished segments are complete, playable files. In resumable mode, the number of frames written into finished
+ * segments is persisted in a progress file next to the output after every segment, so that an interrupted recording can
+ * be resumed from there. The segments of the interrupted recording are concatenated with the new ones on release().
+ */
+class SegmentedEncoder : public EncoderBackend
+{
+public:
+
+  typedef boost::function<boost::shared_ptr<EncoderBackend>()> EncoderFactory;
+
+  /** @brief Constructor.
+   *
+   * @param[in] encoder_factory         creates the encoder of a segment.
+   * @param[in] segment_length          number of frames per segment.
+   * @param[in] max_parallel_segments   maximum number of segments encoded at the same time.
+   * @param[in] max_queued_bytes        maximum number of bytes of the frames queued for all segments.
+   * @param[in] ffmpeg_executable       name or path of the ffmpeg executable that concatenates the segments.
+   */
+  SegmentedEncoder(const EncoderFactory& encoder_factory, int segment_length, int max_parallel_segments,
+                   size_t max_queued_bytes, const std::string& ffmpeg_executable);
+  virtual ~SegmentedEncoder();
+
+  bool open(const std::string& path, double fps, const cv::Size& size) override;
+  bool isOpened() const override;
+  bool write(const cv::Mat& image) override;
+  bool release() override;
+  std::string name() const override;
+
+  /** @brief Returns true - the frames are copied into reused buffers in the queue of the current segment. */
+  bool copiesFrames() const override { return true; }
+
+  /** @brief Selects the encoding of the segments' encoders if they take it. */
+  bool setInputEncoding(const std::string& encoding) override;
+
+  /** @brief Persists the progress and continues an interrupted recording at the given segment.
+   *
+   * Has to be called before open().
+   *
+   * @param[in] first_segment_index     index of the first segment written by this encoder - the segments before are
+   *                                    expected to exist from the interrupted recording.
+   */
+  void enableResuming(size_t first_segment_index);
+
+  /** @brief Returns the path of the file the segment with the given index is written to. */
+  std::string segmentPath(size_t segment_index) const;
+
+  /** @brief Returns the path of the file the progress is persisted in. */
+  std::string progressPath() const;
+
+protected:
+
+  /** @brief A segment and the frames queued for its encoder. */
+  struct Segment
+  {
+    Segment()
+      : is_complete(false)
+        , is_finished(false)
+        , has_failed(false)
+        , num_frames(0)
+    {
+    }
+
+    boost::shared_ptr<EncoderBackend> encoder;
+    std::deque<cv::Mat> queue;
+    boost::shared_ptr<boost::thread> thread;
+    bool is_complete;       ///< True if all frames of the segment are queued.
+    bool is_finished;       ///< True if all frames of the segment are encoded and the file is closed.
+    bool has_failed;
+    size_t num_frames;      ///< Number of frames written into the segment's file.
+  };
+
+  /** @brief Waits until fewer than max_parallel_segments segments are encoding and starts the next segment. */
+  void startSegment();
+
+  /** @brief Marks the current segment as complete, so that its thread finishes once its queue is empty. */
+  void completeSegment();
+
+  /** @brief Feeds the queued frames of the segment to its encoder. Runs in the segment's thread. */
+  void encodeSegment(boost::shared_ptr<Segment> segment, size_t segment_index);
+
+  /** @brief Writes the number of frames in the leading finished segments into the progress file.
+   *
+   * Has to be called while the mutex is locked.
+   */
+  void writeProgress();
+
+  /** @brief Concatenates the segment files into the output file and removes them.
+   *
+   * @return False if ffmpeg failed.
+   */
+  bool concatenateSegments();
+
+  EncoderFactory encoder_factory_;
+  int segment_length_;
+  int max_parallel_segments_;
+  size_t max_queued_bytes_;
+  std::string ffmpeg_executable_;
+  bool is_resumable_;
+  std::string input_encoding_;            ///< Encoding of the frames passed to the segments' encoders.
+  size_t first_segment_index_;            ///< Index of the first segment in segments_.
+
+  std::string path_;
+  std::string path_prefix_;     ///< Output path without its extension.
+  std::string extension_;       ///< Extension of the output path including the dot.
+  double fps_;
+  cv::Size size_;
+  bool is_opened_;
+
+  boost::mutex mutex_;
+  boost::condition_variable condition_;   ///< Notified if a frame is queued or dequeued or a segment finished.
+  std::vector<boost::shared_ptr<Segment> > segments_;
+  int frames_in_segment_;                 ///< Number of frames queued for the current segment.
+  size_t queued_bytes_;                   ///< Number of bytes of the frames queued for all segments.
+  std::vector<cv::Mat> free_images_;      ///< Buffers of encoded frames that write() copies the next frames into.
+  bool has_failed_;
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_SEGMENTED_ENCODER_H
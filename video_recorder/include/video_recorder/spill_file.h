@@ -0,0 +1,136 @@
+/** @file
+ *
+ * Memory-mapped ring file that takes the frames which do not fit into the in-memory ring buffer.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_SPILL_FILE_H
+#define VIDEO_RECORDER_SPILL_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include <ros/time.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "video_recorder/frame_ring_buffer.h"
+
+namespace video_recorder
+{
+
+/** @brief Ring of fixed-size frame records in a memory-mapped file on disk.
+ *
+ * The pixels of the frames are stored uncompressed in the file, their metadata is kept in memory. Frames are read back
+ * in the order they were pushed. The file is sized once on open() and never grows beyond the given disk limit.
+ * Thread-safe for one thread pushing and one thread popping frames - the pixels are copied without holding the lock.
+ * open() and close() must not run concurrently to push() or pop().
+ */
+class SpillFile
+{
+public:
+
+  SpillFile();
+  ~SpillFile();
+
+  /** @brief Creates the file and maps it into memory. Closes a previously opened file.
+   *
+   * @param[in] path        path of the file.
+   * @param[in] max_bytes   maximum size of the file.
+   * @param[in] size        size of the images.
+   * @param[in] type        OpenCV type of the images.
+   * @return False if not even a single frame fits into max_bytes or the file could not be created.
+   */
+  bool open(const std::string& path, size_t max_bytes, const cv::Size& size, int type);
+
+  /** @brief Unmaps and removes the file. */
+  void close();
+
+  bool isOpen() const;
+
+  /** @brief Appends the frame to the file.
+   *
+   * @param[in] image           the image - has to be of the size and type passed to open().
+   * @param[in] encoding        the encoding of the image.
+   * @param[in] arrival_time    the time the image was received.
+   * @param[in] frame_number    the index of the frame within the recording.
+   * @param[in] is_duplicate    true if the image equals the previous one - its pixels are not stored then.
+   * @return False if the file is full or not open.
+   */
+  bool push(const cv::Mat& image, const std::string& encoding, const ros::WallTime& arrival_time,
+            uint64_t frame_number, bool is_duplicate);
+
+  /** @brief Reads the oldest frame back into the slot of the ring buffer and removes it from the file.
+   *
+   * @param[out] frame  the slot - its image has to be allocated for the size and type passed to open().
+   * @return False if the file is empty.
+   */
+  bool pop(Frame& frame);
+
+  /** @brief Returns the number of frames in the file. */
+  size_t size() const;
+
+  bool empty() const { return size() == 0; }
+
+  /** @brief Returns the number of frames that fit into the file or zero if it is not open. */
+  size_t capacity() const;
+
+  /** @brief Returns the number of frames that can be pushed before the file is full. */
+  size_t freeSlots() const;
+
+  /** @brief Number of frames pushed since the last call to resetStatistics(). */
+  uint64_t spilledFrames() const;
+
+  /** @brief Maximum number of frames in the file at once since the last call to resetStatistics(). */
+  size_t maxSize() const;
+
+  /** @brief Returns the number of bytes of a frame record. */
+  size_t recordBytes() const { return record_bytes_; }
+
+  void resetStatistics();
+
+protected:
+
+  /** @brief Metadata of a frame in the file. */
+  struct Record
+  {
+    std::string encoding;
+    ros::WallTime arrival_time;
+    uint64_t frame_number;
+    bool is_duplicate;
+  };
+
+  /** @brief Drops the pages of the popped records up to the record with the given index from the resident memory.
+   *
+   * Only called by the popping thread.
+   *
+   * @param[in] index       index of the popped record.
+   * @param[in] capacity    number of records in the file.
+   */
+  void releasePages(size_t index, size_t capacity);
+
+  mutable boost::mutex mutex_;
+  std::string path_;
+  int file_descriptor_;
+  unsigned char* data_;           ///< Mapped file.
+  size_t record_bytes_;           ///< Bytes of a frame's pixels.
+  cv::Size image_size_;
+  int image_type_;
+
+  std::vector<Record> records_;
+  size_t head_;                   ///< Number of frames pushed so far.
+  size_t tail_;                   ///< Number of frames popped so far.
+  size_t released_bytes_;         ///< Offset up to which the pages of the popped records were dropped.
+
+  uint64_t spilled_frames_;
+  size_t max_size_;
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_SPILL_FILE_H
@@ -0,0 +1,70 @@
+/** @file
+ *
+ * Vectorized alpha blending of a watermark into video frames.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_WATERMARK_BLENDER_H
+#define VIDEO_RECORDER_WATERMARK_BLENDER_H
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace video_recorder
+{
+
+/** @brief Blends a watermark into the bottom right corner of images.
+ *
+ * The per-pixel weights and the premultiplied watermark colors are computed once in an 8-bit blend table, so that
+ * blending a frame only needs integer multiply-adds. Rows of the watermark that are fully transparent are skipped.
+ * The blend kernel is vectorized with AVX2 or SSE2 if the CPU supports it and falls back to scalar code otherwise.
+ */
+class WatermarkBlender
+{
+public:
+
+  /** @brief Precomputes the blend table.
+   *
+   * @param[in] watermark   BGRA watermark - pixels with alpha zero are transparent.
+   * @param[in] channels    number of channels of the images the watermark is blended into - 3 or 4.
+   * @param[in] opacity     opacity of the non-transparent watermark pixels.
+   */
+  WatermarkBlender(const cv::Mat& watermark, int channels = 3, float opacity = 0.2f);
+
+  /** @brief Blends the watermark into the bottom right corner of the image.
+   *
+   * @param[in,out] image   8-bit image with the number of channels the blender was created for.
+   */
+  void apply(cv::Mat& image) const;
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int channels() const { return channels_; }
+
+  /** @brief Returns the name of the blend kernel selected for this CPU. */
+  static const char* kernelName();
+
+protected:
+
+  /** @brief Non-transparent part of a watermark row. */
+  struct RowSpan
+  {
+    int row;          ///< Row in the watermark.
+    int begin_col;    ///< First non-transparent column.
+    int end_col;      ///< One past the last non-transparent column.
+  };
+
+  int rows_;
+  int cols_;
+  int channels_;
+  std::vector<uint8_t> weights_;        ///< Per-channel weight of the image pixel scaled to [0, 255].
+  std::vector<uint8_t> premultiplied_;  ///< Per-channel watermark color premultiplied with its weight.
+  std::vector<RowSpan> spans_;          ///< Rows that contain at least one non-transparent pixel.
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_WATERMARK_BLENDER_H
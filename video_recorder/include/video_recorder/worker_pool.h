@@ -0,0 +1,102 @@
+/** @file
+ *
+ * Pool of worker threads shared by the recording sessions.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_WORKER_POOL_H
+#define VIDEO_RECORDER_WORKER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+#include <boost/thread.hpp>
+
+namespace video_recorder
+{
+
+/** @brief Source of the tasks run by a worker pool. */
+class WorkerPoolClient
+{
+public:
+
+  virtual ~WorkerPoolClient() {}
+
+  /** @brief Returns true if a task can be started. Called while the pool's mutex is locked, so it must not block. */
+  virtual bool hasTask() = 0;
+
+  /** @brief Returns the cost of the next task, e.g. the number of bytes it processes. */
+  virtual size_t taskCost() = 0;
+
+  /** @brief Runs the next task in the calling worker thread.
+   *
+   * @return False if no task could be started, e.g. because another worker took it.
+   */
+  virtual bool runTask() = 0;
+};
+
+/** @brief Runs the tasks of several clients on a bounded number of worker threads.
+ *
+ * The clients are served by fair queuing: every worker picks the client with a task that was served the least cost so
+ * far, so that clients with expensive tasks - e.g. a 4K stream - get the same share of the workers as clients with
+ * cheap tasks instead of starving them. A client that was idle is not credited for the time it was idle.
+ */
+class WorkerPool
+{
+public:
+
+  /** @brief Starts the worker threads.
+   *
+   * @param[in] num_threads     number of worker threads.
+   */
+  explicit WorkerPool(int num_threads);
+
+  /** @brief Stops and joins the worker threads. */
+  ~WorkerPool();
+
+  /** @brief Adds a client whose tasks are run by the workers. */
+  void addClient(WorkerPoolClient* client);
+
+  /** @brief Removes the client and blocks until none of its tasks is running anymore. */
+  void removeClient(WorkerPoolClient* client);
+
+  /** @brief Wakes up the workers - has to be called if a client may have a task now. */
+  void notify();
+
+  int numThreads() const { return num_threads_; }
+
+protected:
+
+  /** @brief Bookkeeping of a client. */
+  struct ClientState
+  {
+    ClientState()
+      : served_cost(0)
+        , num_running_tasks(0)
+        , is_removed(false)
+    {
+    }
+
+    uint64_t served_cost;       ///< Cost of the tasks started so far - lifted to the virtual time after idling.
+    int num_running_tasks;
+    bool is_removed;            ///< True if the client is being removed - no further tasks are started.
+  };
+
+  /** @brief Runs tasks of the clients until the pool is stopped. */
+  void work();
+
+  int num_threads_;
+  boost::mutex mutex_;
+  boost::condition_variable task_condition_;      ///< Notified if a client may have a task.
+  boost::condition_variable finished_condition_;  ///< Notified if a task finished.
+  std::map<WorkerPoolClient*, ClientState> clients_;
+  uint64_t virtual_time_;                         ///< Served cost of the client picked last.
+  bool is_shutting_down_;
+  boost::thread_group threads_;
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_WORKER_POOL_H
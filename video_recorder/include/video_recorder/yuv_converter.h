@@ -0,0 +1,46 @@
+/** @file
+ *
+ * Conversion of color images to planar YUV 4:2:0.
+ *
+ * @author Jan Razlaw
+ */
+
+#ifndef VIDEO_RECORDER_YUV_CONVERTER_H
+#define VIDEO_RECORDER_YUV_CONVERTER_H
+
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+namespace video_recorder
+{
+
+/// Encoding of planar YUV 4:2:0 images - the Y plane followed by the U and the V plane in a single channel image of
+/// 3/2 times the height of the picture, as produced by cv::COLOR_BGR2YUV_I420.
+const std::string YUV420P = "yuv420p";
+
+/** @brief Converts color images to planar YUV 4:2:0 with the limited range BT.601 coefficients of ffmpeg and OpenCV.
+ *
+ * The conversion is done by cv::cvtColor, which reads the channel order of BGR, RGB, BGRA and RGBA images directly and
+ * takes the chroma of a 2x2 block from its top left pixel. Its vectorized kernels outperformed hand-written AVX2 and
+ * SSE4.1 kernels that average the chroma of the block, so the converter only maps the encodings to its color codes.
+ */
+class YuvConverter
+{
+public:
+
+  /** @brief Returns true if images of the encoding can be converted - bgr8, rgb8, bgra8 and rgba8. */
+  static bool isConvertible(const std::string& encoding);
+
+  /** @brief Converts the image to planar YUV 4:2:0.
+   *
+   * @param[in] image       8-bit image of even width and height.
+   * @param[in] encoding    encoding of the image - see isConvertible().
+   * @param[out] yuv        single channel image of 3/2 times the height of the image - reused if it has that size.
+   */
+  static void convert(const cv::Mat& image, const std::string& encoding, cv::Mat& yuv);
+};
+
+}  // namespace video_recorder
+
+#endif // VIDEO_RECORDER_YUV_CONVERTER_H
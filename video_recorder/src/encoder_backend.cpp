@@ -0,0 +1,344 @@
+/** @file
+ *
+ * Encoder backends that write frames to a video file.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/encoder_backend.h"
+
+#include <algorithm>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+namespace video_recorder
+{
+
+std::string shellQuote(const std::string& argument)
+{
+  std::string quoted = "'";
+  for(char c : argument)
+  {
+    if(c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+}
+
+std::string stripExtension(const std::string& path)
+{
+  // strip the extension of the file name, but not of a directory 
+  size_t extension_start = path.find_last_of('.');
+  size_t file_name_start = path.find_last_of('/');
+  if(extension_start != std::string::npos && (file_name_start == std::string::npos || extension_start > file_name_start))
+    return path.substr(0, extension_start);
+  return path;
+}
+
+FfmpegSettings losslessFfmpegSettings(int num_threads)
+{
+  // ffv1 splits the frame into v x h slices with v <= h < 2v, pick the largest count that keeps all threads busy 
+  int slices = 4;
+  for(int v = 2; v * v <= 64; ++v)
+    for(int h = v; h < 2 * v; ++h)
+      if(v * h <= std::max(4, num_threads) && v * h > slices)
+        slices = v * h;
+
+  FfmpegSettings settings;
+  settings.codec = "ffv1";
+  settings.pixel_format = "bgr0";
+  settings.threads = num_threads;
+  settings.slices = slices;
+  // version 3 supports slice threading, intra-only frames keep the video seekable for editing 
+  settings.codec_options = {"-level", "3", "-slicecrc", "1", "-g", "1"};
+  return settings;
+}
+
+OpenCvEncoder::OpenCvEncoder(int codec)
+  : codec_(codec)
+{
+}
+
+bool OpenCvEncoder::open(const std::string& path, double fps, const cv::Size& size)
+{
+  return video_writer_.open(path, codec_, fps, size, true);
+}
+
+bool OpenCvEncoder::isOpened() const
+{
+  return video_writer_.isOpened();
+}
+
+bool OpenCvEncoder::write(const cv::Mat& image)
+{
+  video_writer_.write(image);
+  return true;
+}
+
+bool OpenCvEncoder::release()
+{
+  if(video_writer_.isOpened())
+    video_writer_.release();
+  return true;
+}
+
+std::string OpenCvEncoder::name() const
+{
+  std::string fourcc(4, ' ');
+  for(int i = 0; i < 4; ++i)
+    fourcc[i] = static_cast<char>((codec_ >> (8 * i)) & 0xFF);
+  return "OpenCV " + fourcc;
+}
+
+FfmpegEncoder::FfmpegEncoder(const FfmpegSettings& settings)
+  : settings_(settings)
+    , pipe_(nullptr)
+    , input_pixel_format_("bgr24")
+    , input_type_(CV_8UC3)
+{
+}
+
+FfmpegEncoder::~FfmpegEncoder()
+{
+  release();
+}
+
+std::string FfmpegEncoder::buildCommand(const std::string& path, double fps, const cv::Size& size) const
+{
+  // planar YUV 4:2:0 frames stack the chroma planes below the picture 
+  const int height = input_type_ == CV_8UC1 ? size.height * 2 / 3 : size.height;
+
+  std::ostringstream command;
+  command << shellQuote(settings_.executable) << " -y -loglevel error"
+          << " -f rawvideo -pixel_format " << input_pixel_format_ << " -video_size " << size.width << "x" << height
+          << " -framerate " << fps << " -i -";
+
+  if(!settings_.codec.empty())
+    command << " -c:v " << shellQuote(settings_.codec);
+  if(!settings_.preset.empty())
+    command << " -preset " << shellQuote(settings_.preset);
+  if(settings_.crf >= 0)
+    command << " -crf " << settings_.crf;
+  if(!settings_.pixel_format.empty())
+    command << " -pix_fmt " << shellQuote(settings_.pixel_format);
+  if(settings_.threads > 0)
+    command << " -threads " << settings_.threads;
+  if(settings_.slices > 0)
+    command << " -slices " << settings_.slices;
+  for(const std::string& option : settings_.codec_options)
+    command << " " << shellQuote(option);
+
+  command << " " << shellQuote(path);
+  return command.str();
+}
+
+/** @brief Blocks SIGPIPE in the calling thread for its lifetime and discards a SIGPIPE raised in the meantime.
+ *
+ * Writing into the pipe of a crashed ffmpeg process raises SIGPIPE, which would take the whole nodelet manager down.
+ * Instead of ignoring the signal process-wide, it is only blocked around the pipe operations, so that they fail with
+ * EPIPE, and the pending signal is consumed before the thread's signal mask is restored.
+ */
+class ScopedSigpipeBlock
+{
+public:
+
+  ScopedSigpipeBlock()
+  {
+    sigemptyset(&sigpipe_);
+    sigaddset(&sigpipe_, SIGPIPE);
+
+    // a SIGPIPE that was pending before belongs to someone else and must not be consumed 
+    sigset_t pending;
+    sigpending(&pending);
+    was_pending_ = sigismember(&pending, SIGPIPE) == 1;
+
+    pthread_sigmask(SIG_BLOCK, &sigpipe_, &old_mask_);
+  }
+
+  ~ScopedSigpipeBlock()
+  {
+    if(!was_pending_)
+    {
+      sigset_t pending;
+      sigpending(&pending);
+      if(sigismember(&pending, SIGPIPE) == 1)
+      {
+        const timespec no_timeout = {0, 0};
+        sigtimedwait(&sigpipe_, nullptr, &no_timeout);
+      }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask_, nullptr);
+  }
+
+private:
+
+  sigset_t sigpipe_;
+  sigset_t old_mask_;
+  bool was_pending_;
+};
+
+bool FfmpegEncoder::open(const std::string& path, double fps, const cv::Size& size)
+{
+  release();
+
+  pipe_ = popen(buildCommand(path, fps, size).c_str(), "w");
+  size_ = size;
+  return pipe_ != nullptr;
+}
+
+bool FfmpegEncoder::setInputEncoding(const std::string& encoding)
+{
+  // the piped frames are converted to the codec's pixel format anyway - ffmpeg swizzles the channels in the same pass 
+  if(encoding == "bgr8")
+    input_pixel_format_ = "bgr24";
+  else if(encoding == "rgb8")
+    input_pixel_format_ = "rgb24";
+  else if(encoding == "bgra8")
+    input_pixel_format_ = "bgra";
+  else if(encoding == "rgba8")
+    input_pixel_format_ = "rgba";
+  else if(encoding == "yuv420p" && settings_.pixel_format == "yuv420p")
+    input_pixel_format_ = "yuv420p";
+  else
+    return false;
+
+  if(encoding == "yuv420p")
+    input_type_ = CV_8UC1;
+  else
+    input_type_ = (encoding == "bgra8" || encoding == "rgba8") ? CV_8UC4 : CV_8UC3;
+  return true;
+}
+
+bool FfmpegEncoder::isOpened() const
+{
+  return pipe_ != nullptr;
+}
+
+bool FfmpegEncoder::write(const cv::Mat& image)
+{
+  if(!pipe_ || image.size() != size_ || image.type() != input_type_)
+    return false;
+
+  // a crashed ffmpeg process makes the writes fail with EPIPE 
+  ScopedSigpipeBlock sigpipe_block;
+
+  const size_t row_bytes = image.cols * image.elemSize();
+  if(image.isContinuous())
+    return fwrite(image.data, row_bytes * image.rows, 1, pipe_) == 1;
+
+  for(int row = 0; row < image.rows; ++row)
+    if(fwrite(image.ptr(row), row_bytes, 1, pipe_) != 1)
+      return false;
+  return true;
+}
+
+bool FfmpegEncoder::release()
+{
+  if(!pipe_)
+    return true;
+
+  // closing the pipe signals the end of the stream and waits for ffmpeg to finalize the file - popen succeeds even if
+  // ffmpeg is missing or rejects its arguments, so only its exit status tells whether the file was written 
+  int status = -1;
+  {
+    // pclose flushes the buffered frame data into the pipe as well 
+    ScopedSigpipeBlock sigpipe_block;
+    status = pclose(pipe_);
+  }
+  pipe_ = nullptr;
+  return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::string FfmpegEncoder::name() const
+{
+  return "ffmpeg " + settings_.codec;
+}
+
+ImageSequenceEncoder::ImageSequenceEncoder(const std::string& format, int png_compression_level, int num_digits)
+  : format_(format)
+    , num_digits_(num_digits)
+    , is_opened_(false)
+    , next_frame_number_(0)
+{
+  if(format_ == "png")
+    write_params_ = {cv::IMWRITE_PNG_COMPRESSION, std::max(0, std::min(9, png_compression_level))};
+}
+
+bool ImageSequenceEncoder::open(const std::string& path, double fps, const cv::Size& size)
+{
+  if(format_ != "png" && format_ != "tiff" && format_ != "raw")
+    return false;
+
+  path_prefix_ = stripExtension(path);
+  next_frame_number_ = 0;
+  is_opened_ = true;
+  return true;
+}
+
+bool ImageSequenceEncoder::isOpened() const
+{
+  return is_opened_;
+}
+
+bool ImageSequenceEncoder::write(const cv::Mat& image)
+{
+  return writeFrame(image, next_frame_number_++);
+}
+
+bool ImageSequenceEncoder::release()
+{
+  is_opened_ = false;
+  return true;
+}
+
+std::string ImageSequenceEncoder::name() const
+{
+  return "image sequence " + format_;
+}
+
+std::string ImageSequenceEncoder::framePath(uint64_t frame_number) const
+{
+  std::ostringstream path;
+  path << path_prefix_ << "_" << std::setw(num_digits_) << std::setfill('0') << frame_number << "." << format_;
+  return path.str();
+}
+
+bool ImageSequenceEncoder::writeFrame(const cv::Mat& image, uint64_t frame_number)
+{
+  if(!is_opened_)
+    return false;
+
+  if(format_ != "raw")
+    return cv::imwrite(framePath(frame_number), image, write_params_);
+
+  std::ofstream file(framePath(frame_number), std::ios::binary);
+  const size_t row_bytes = image.cols * image.elemSize();
+  for(int row = 0; row < image.rows && file; ++row)
+    file.write(reinterpret_cast<const char*>(image.ptr(row)), row_bytes);
+  return static_cast<bool>(file);
+}
+
+bool ImageSequenceEncoder::writeDuplicate(uint64_t frame_number)
+{
+  if(!is_opened_ || frame_number == 0)
+    return false;
+
+  // the previous frame is already written since the writer stage repeats frames in order 
+  const std::string path = framePath(frame_number);
+  unlink(path.c_str());
+  return link(framePath(frame_number - 1).c_str(), path.c_str()) == 0;
+}
+
+}  // namespace video_recorder
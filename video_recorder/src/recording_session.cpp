@@ -0,0 +1,1169 @@
+/** @file
+ *
+ * Records the images of one image stream into a video.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/recording_session.h"
+
+namespace video_recorder
+{
+
+// Encodings that are converted to BGR by the preprocessing stage instead of the image callback
+static inline bool isConvertedInPreprocessing(const std::string& encoding)
+{
+  return encoding == sensor_msgs::image_encodings::BGR8 ||
+         encoding == sensor_msgs::image_encodings::RGB8 ||
+         encoding == sensor_msgs::image_encodings::BGRA8 ||
+         encoding == sensor_msgs::image_encodings::RGBA8 ||
+         encoding == sensor_msgs::image_encodings::MONO8;
+}
+
+// Hashes every row_step-th row of the image - fast enough to run on every received frame
+static uint64_t hashSampledRows(const cv::Mat& image, int row_step)
+{
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const size_t row_bytes = image.cols * image.elemSize();
+  for(int row = 0; row < image.rows; row += row_step)
+  {
+    const unsigned char* data = image.ptr(row);
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= row_bytes; i += sizeof(uint64_t))
+    {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(uint64_t));
+      hash = (hash ^ word) * prime;
+      hash ^= hash >> 32;
+    }
+    for(; i < row_bytes; ++i)
+      hash = (hash ^ data[i]) * prime;
+  }
+  return hash;
+}
+
+// Returns true if both images have the same size and type and equal pixels
+static bool isEqual(const cv::Mat& image, const cv::Mat& other)
+{
+  if(image.size() != other.size() || image.type() != other.type())
+    return false;
+
+  const size_t row_bytes = image.cols * image.elemSize();
+  if(image.isContinuous() && other.isContinuous())
+    return std::memcmp(image.data, other.data, row_bytes * image.rows) == 0;
+
+  for(int row = 0; row < image.rows; ++row)
+    if(std::memcmp(image.ptr(row), other.ptr(row), row_bytes) != 0)
+      return false;
+  return true;
+}
+
+// Keeps the image by swapping the buffer it points into with the retained one instead of copying it - the buffer of
+// the slot takes over the previously retained image and is only reallocated if the next frame differs in size.
+// Returns false if the image is not backed by one of the buffers
+static bool retainImage(const cv::Mat& image, std::initializer_list<cv::Mat*> buffers, cv::Mat& retained)
+{
+  for(cv::Mat* buffer : buffers)
+  {
+    if(!buffer->empty() && buffer->data == image.data && buffer->size() == image.size())
+    {
+      std::swap(*buffer, retained);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the size of a rendition - zero dimensions are derived from the output size keeping its aspect ratio
+static cv::Size renditionSize(const cv::Size& requested_size, const cv::Size& output_size)
+{
+  if(requested_size.width > 0 && requested_size.height > 0)
+    return requested_size;
+  if(requested_size.width > 0)
+    return cv::Size(requested_size.width,
+                    std::max(2, 2 * cvRound(0.5 * requested_size.width * output_size.height / output_size.width)));
+  if(requested_size.height > 0)
+    return cv::Size(std::max(2, 2 * cvRound(0.5 * requested_size.height * output_size.width / output_size.height)),
+                    requested_size.height);
+  return output_size;
+}
+
+// Reads the parameter of the session - falls back to the parameter of the recorder
+template<typename T>
+static void sessionParam(const ros::NodeHandle& private_nh, const ros::NodeHandle& session_nh, const std::string& name,
+                         T& value)
+{
+  private_nh.param(name, value, value);
+  session_nh.param(name, value, value);
+}
+
+RecordingSession::RecordingSession(const std::string& name, const std::string& topic_prefix,
+                                   const ros::NodeHandle& private_nh, const ros::NodeHandle& session_nh,
+                                   const boost::shared_ptr<WorkerPool>& worker_pool)
+  : name_(name)
+    , nh_("")
+    , worker_pool_(worker_pool)
+    , memory_budget_(1024. * 1024. * 1024.)
+    , spill_budget_(0.)
+    , spill_path_("/tmp/video_recorder_spill_" + std::to_string(getpid()))
+    , frame_footprint_(0)
+    , bytes_in_flight_(0)
+    , max_preprocessed_frames_(16)
+    , received_frames_counter_(0)
+    , lost_frames_counter_(0)
+    , ring_copies_counter_(0)
+    , spill_copies_counter_(0)
+    , segment_copies_counter_(0)
+    , retained_copies_counter_(0)
+    , conversion_copies_counter_(0)
+    , duplicate_frames_counter_(0)
+    , has_image_seq_(false)
+    , last_image_seq_(0)
+    , duplicate_detection_row_step_(4)
+    , last_frame_hash_(0)
+    , is_shutting_down_(false)
+    , num_pending_finalizations_(0)
+    , recording_id_(0)
+    , encoded_bytes_(0)
+    , metrics_rate_(1.0)
+    , max_parallel_segments_(std::max(2, (int)boost::thread::hardware_concurrency() / 4))
+    , segment_memory_budget_(1024. * 1024. * 1024.)
+    , path_to_output_("")
+    , target_fps_(60)
+    , frame_number_offset_(0)
+    , renditions_(boost::make_shared<const std::vector<Rendition> >())
+    , output_encoding_(sensor_msgs::image_encodings::BGR8)
+    , add_watermark_(true)
+{
+  sessionParam(private_nh, session_nh, "memory_budget", memory_budget_);
+  sessionParam(private_nh, session_nh, "spill_budget", spill_budget_);
+  private_nh.param("spill_path", spill_path_, spill_path_);
+  // the sessions must not share the spill file
+  if(!topic_prefix.empty())
+    spill_path_ += "_" + topic_prefix.substr(1);
+  session_nh.param("spill_path", spill_path_, spill_path_);
+  sessionParam(private_nh, session_nh, "max_preprocessed_frames", max_preprocessed_frames_);
+  max_preprocessed_frames_ = std::max(1, max_preprocessed_frames_);
+  int output_width = 0;
+  int output_height = 0;
+  sessionParam(private_nh, session_nh, "output_width", output_width);
+  sessionParam(private_nh, session_nh, "output_height", output_height);
+  if(output_width > 0 && output_height > 0)
+    output_size_ = cv::Size(output_width, output_height);
+  sessionParam(private_nh, session_nh, "duplicate_detection_row_step", duplicate_detection_row_step_);
+  sessionParam(private_nh, session_nh, "metrics_rate", metrics_rate_);
+  sessionParam(private_nh, session_nh, "max_parallel_segments", max_parallel_segments_);
+  sessionParam(private_nh, session_nh, "segment_memory_budget", segment_memory_budget_);
+  sessionParam(private_nh, session_nh, "ffmpeg_executable", default_ffmpeg_settings_.executable);
+
+  // the callbacks may block on a full pipeline - they must not stall the callbacks of the other sessions
+  nh_.setCallbackQueue(&callback_queue_);
+
+  record_finished_pub_ = nh_.advertise<rviz_cinematographer_msgs::Finished>(
+    topic_prefix + "/video_recorder/record_finished", 1);
+  recording_finalized_pub_ = nh_.advertise<rviz_cinematographer_msgs::RecordingFinalized>(
+    topic_prefix + "/video_recorder/recording_finalized", 10);
+  credits_pub_ = nh_.advertise<rviz_cinematographer_msgs::Credits>(topic_prefix + "/video_recorder/credits", 1, true);
+  metrics_pub_ = nh_.advertise<rviz_cinematographer_msgs::RecorderMetrics>(topic_prefix + "/video_recorder/metrics",
+                                                                           10);
+  period_start_time_ = ros::WallTime::now();
+  if(metrics_rate_ > 0.0)
+    metrics_timer_ = nh_.createWallTimer(ros::WallDuration(1.0 / metrics_rate_),
+                                         &RecordingSession::publishMetrics, this);
+
+  write_images_thread_ = boost::shared_ptr<boost::thread>(
+    new boost::thread(boost::bind(&RecordingSession::writeImages, this)));
+  refill_images_thread_ = boost::shared_ptr<boost::thread>(
+    new boost::thread(boost::bind(&RecordingSession::refillImages, this)));
+  finalize_thread_ = boost::shared_ptr<boost::thread>(
+    new boost::thread(boost::bind(&RecordingSession::finalizeRecordings, this)));
+  worker_pool_->addClient(this);
+
+  record_params_sub_ = nh_.subscribe(topic_prefix + "/rviz/record", 1, &RecordingSession::recordParamsCallback, this);
+  rendering_finished_sub_ = nh_.subscribe(topic_prefix + "/rviz/finished_rendering_trajectory", 1,
+                                          &RecordingSession::renderingFinishedCallback, this);
+
+  image_transport::ImageTransport it(nh_);
+  image_sub_ = it.subscribe(topic_prefix + "/rviz/view_image", rviz_cinematographer_msgs::Credits::MAX_FREE_SLOTS,
+                            &RecordingSession::imageCallback, this);
+
+  spinner_ = boost::make_shared<ros::AsyncSpinner>(1, &callback_queue_);
+  spinner_->start();
+}
+
+RecordingSession::~RecordingSession()
+{
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    is_shutting_down_ = true;
+  }
+  frame_preprocessed_condition_.notify_all();
+  frame_released_condition_.notify_all();
+  frame_spilled_condition_.notify_all();
+  finalize_condition_.notify_all();
+
+  worker_pool_->removeClient(this);
+  spinner_->stop();
+  metrics_timer_.stop();
+  write_images_thread_->join();
+  refill_images_thread_->join();
+  finalize_thread_->join();
+}
+
+void RecordingSession::recordParamsCallback(const rviz_cinematographer_msgs::Record::ConstPtr& record_params)
+{
+  boost::mutex::scoped_lock record_params_lock(record_params_mutex_);
+  {
+    // the previous recording may still be draining - its encoders are detached once its frames are written 
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    if(num_pending_finalizations_ > 0)
+    {
+      pending_record_params_ = record_params;
+      return;
+    }
+  }
+
+  applyRecordParams(record_params);
+}
+
+void RecordingSession::applyRecordParams(const rviz_cinematographer_msgs::Record::ConstPtr& record_params)
+{
+  int max_fps = 120;
+  if(record_params->lossless == 0 && record_params->encoder == rviz_cinematographer_msgs::Record::OPENCV &&
+     record_params->compress == 0)
+    max_fps = 60;
+  const int target_fps = std::max(1, std::min(max_fps, (int)record_params->frames_per_second));
+
+  boost::shared_ptr<EncoderBackend> encoder = createEncoder(*record_params);
+  if(!encoder)
+  {
+    ROS_ERROR_STREAM_NAMED(name_, "Unknown encoder " << (int)record_params->encoder << " requested.");
+    return;
+  }
+
+  // encode segments of the video on separate encoder instances in parallel - finished segments survive a crash 
+  int segment_length = record_params->segment_length;
+  if(record_params->resumable > 0 && segment_length == 0)
+    segment_length = 10 * target_fps;
+  if(segment_length > 0 && !encoder->encodesInWorkers())
+  {
+    boost::shared_ptr<SegmentedEncoder> segmented_encoder = boost::make_shared<SegmentedEncoder>(
+      boost::bind(&RecordingSession::createEncoder, this, *record_params), segment_length,
+      max_parallel_segments_, static_cast<size_t>(segment_memory_budget_), default_ffmpeg_settings_.executable);
+
+    // an interrupted recording can only be continued with a new segment 
+    if(record_params->resumable > 0)
+    {
+      if(record_params->start_frame % segment_length != 0)
+      {
+        ROS_ERROR_STREAM_NAMED(name_, "Can't resume the recording at frame " << record_params->start_frame
+                               << " as it is not the first frame of a segment of " << segment_length << " frames.");
+        return;
+      }
+      segmented_encoder->enableResuming(record_params->start_frame / segment_length);
+    }
+    encoder = segmented_encoder;
+  }
+  else if(record_params->start_frame > 0 && !encoder->encodesInWorkers())
+  {
+    ROS_ERROR_STREAM_NAMED(name_, "Can't resume a recording with " << encoder->name() << " that is not resumable.");
+    return;
+  }
+
+  // additional renditions are encoded with OpenCV's divx or the requested ffmpeg codec 
+  boost::shared_ptr<std::vector<Rendition> > renditions = boost::make_shared<std::vector<Rendition> >();
+  bool is_watermark_needed = record_params->add_watermark > 0;
+  for(size_t i = 0; i < record_params->renditions.size(); ++i)
+  {
+    const rviz_cinematographer_msgs::Rendition& rendition_params = record_params->renditions[i];
+    Rendition rendition;
+    rendition.size = cv::Size(rendition_params.width, rendition_params.height);
+    rendition.add_watermark = rendition_params.add_watermark > 0;
+    rendition.path_to_output = rendition_params.path_to_output;
+    if(rendition.path_to_output.empty())
+    {
+      const std::string& path = record_params->path_to_output;
+      std::string path_prefix = stripExtension(path);
+      rendition.path_to_output = path_prefix + "_" + std::to_string(i) + path.substr(path_prefix.size());
+    }
+
+    if(rendition_params.codec.empty())
+      rendition.encoder = boost::make_shared<OpenCvEncoder>(cv::VideoWriter::fourcc('D', 'I', 'V', 'X'));
+    else
+    {
+      FfmpegSettings settings = default_ffmpeg_settings_;
+      settings.codec = rendition_params.codec;
+      if(rendition_params.use_crf)
+        settings.crf = rendition_params.crf;
+      rendition.encoder = boost::make_shared<FfmpegEncoder>(settings);
+    }
+
+    renditions->push_back(rendition);
+    is_watermark_needed = is_watermark_needed || rendition.add_watermark;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    if(encoder_ && encoder_->isOpened())
+    {
+      ROS_WARN_NAMED(name_, "Can't change the record parameters while recording.");
+      return;
+    }
+
+    encoder_ = encoder;
+    renditions_ = renditions;
+    output_encoding_ = sensor_msgs::image_encodings::BGR8;
+    target_fps_ = target_fps;
+    path_to_output_ = record_params->path_to_output;
+    frame_number_offset_ = record_params->start_frame;
+    recording_id_ = record_params->recording_id;
+
+    encoded_bytes_ = 0;
+    recording_statistics_.reset();
+  }
+
+  received_frames_counter_ = 0;
+  lost_frames_counter_ = 0;
+  ring_copies_counter_ = 0;
+  spill_copies_counter_ = 0;
+  segment_copies_counter_ = 0;
+  retained_copies_counter_ = 0;
+  conversion_copies_counter_ = 0;
+  duplicate_frames_counter_ = 0;
+  spill_file_.resetStatistics();
+  publishCredits();
+
+  add_watermark_ = record_params->add_watermark > 0;
+
+  if(is_watermark_needed)
+  {
+    // load watermark 
+    std::string path_to_watermark = ros::package::getPath("video_recorder");
+    if(path_to_watermark.empty())
+      ROS_ERROR_NAMED(name_, "Can't find path to video_recorder to load watermark.");
+    else
+    {
+      path_to_watermark += "/watermark/watermark.png";
+      boost::mutex::scoped_lock lock(watermark_mutex_);
+      original_watermark_ = cv::imread(path_to_watermark, cv::IMREAD_UNCHANGED);
+      watermark_blenders_.clear();
+    }
+  }
+}
+
+void
+RecordingSession::renderingFinishedCallback(const rviz_cinematographer_msgs::Finished::ConstPtr& rendering_finished)
+{
+  if(rendering_finished->is_finished)
+  {
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      num_pending_finalizations_++;
+    }
+    finalize_condition_.notify_all();
+  }
+}
+
+void RecordingSession::finalizeRecordings()
+{
+  while(true)
+  {
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      while(num_pending_finalizations_ == 0 && !is_shutting_down_)
+        finalize_condition_.wait(lock);
+
+      // the encoders of pending recordings are still released on shutdown, so that their files are closed 
+      if(num_pending_finalizations_ == 0)
+        return;
+    }
+
+    // the encoders are detached once all frames of the finished recording are written 
+    waitUntilDrained();
+
+    boost::shared_ptr<EncoderBackend> encoder;
+    boost::shared_ptr<const std::vector<Rendition> > renditions = boost::make_shared<const std::vector<Rendition> >();
+    rviz_cinematographer_msgs::RecorderMetrics summary;
+    rviz_cinematographer_msgs::RecordingFinalized finalized;
+    uint64_t encoded_bytes = 0;
+    ros::WallTime first_arrival_time;
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      encoder.swap(encoder_);
+      renditions.swap(renditions_);
+
+      if(received_frames_counter_ > 0)
+      {
+        const uint64_t frame_copies = ring_copies_counter_ + spill_copies_counter_ + segment_copies_counter_ +
+                                      retained_copies_counter_ + conversion_copies_counter_;
+        ROS_INFO_STREAM_NAMED(name_, "Recorded " << received_frames_counter_ << " frames with " << frame_copies
+                              << " full-frame copies (" << static_cast<double>(frame_copies) / received_frames_counter_
+                              << " per frame).");
+      }
+
+      if(duplicate_frames_counter_ > 0)
+        ROS_INFO_STREAM_NAMED(name_, "Repeated the previous frame for " << duplicate_frames_counter_
+                              << " duplicate frames.");
+
+      if(spill_file_.spilledFrames() > 0)
+        ROS_INFO_STREAM_NAMED(name_, "Spilled " << spill_file_.spilledFrames() << " frames ("
+                              << spill_file_.spilledFrames() * spill_file_.recordBytes() / 1e6
+                              << " MB) to disk, at most " << spill_file_.maxSize() << " of " << spill_file_.capacity()
+                              << " at once.");
+
+      double recording_duration = 0.0;
+      if(received_frames_counter_ > 0)
+        recording_duration = (ros::WallTime::now() - first_arrival_time_).toSec();
+      summary = collectMetrics(recording_statistics_, recording_duration);
+      summary.is_summary = true;
+
+      const uint64_t written_frames = recording_statistics_.numFrames();
+      const double encode_duration_sum = recording_statistics_.encodeDurationSum();
+      if(written_frames > 0)
+      {
+        ROS_INFO_STREAM_NAMED(name_, "Duration from image arrival to encode start - p50: " << summary.latency_p50
+                              << "s, p99: " << summary.latency_p99 << "s, max: " << summary.latency_max << "s.");
+        if(encoder && encode_duration_sum > 0.0)
+          ROS_INFO_STREAM_NAMED(name_, encoder->name() << " encoded " << written_frames << " frames at "
+                                << written_frames / encode_duration_sum << " frames per second, "
+                                << encoded_bytes_ / encode_duration_sum / 1e6 << " MB/s.");
+      }
+
+      // the next recording may start as soon as the encoders are detached 
+      finalized.path_to_output = path_to_output_;
+      finalized.frames = written_frames;
+      finalized.video_duration = static_cast<double>(written_frames) / target_fps_;
+      encoded_bytes = encoded_bytes_;
+      first_arrival_time = first_arrival_time_;
+      num_pending_finalizations_--;
+    }
+
+    // all frames are processed - the output is closed in the background 
+    rviz_cinematographer_msgs::Finished record_finished;
+    record_finished.is_finished = true;
+    record_finished_pub_.publish(record_finished);
+
+    // the next recording may have been requested while this one was draining 
+    {
+      boost::mutex::scoped_lock record_params_lock(record_params_mutex_);
+      rviz_cinematographer_msgs::Record::ConstPtr record_params;
+      {
+        boost::mutex::scoped_lock lock(pipeline_mutex_);
+        if(num_pending_finalizations_ == 0)
+          record_params.swap(pending_record_params_);
+      }
+      if(record_params)
+        applyRecordParams(record_params);
+    }
+
+    ros::WallTime finalize_start = ros::WallTime::now();
+    finalized.success = true;
+    if(encoder && !encoder->release())
+    {
+      ROS_ERROR_STREAM_NAMED(name_, encoder->name() << " failed to finalize " << finalized.path_to_output << ".");
+      finalized.success = false;
+    }
+    for(const Rendition& rendition : *renditions)
+    {
+      if(!rendition.encoder->release())
+      {
+        ROS_ERROR_STREAM_NAMED(name_, rendition.encoder->name() << " failed to finalize " << rendition.path_to_output
+                               << ".");
+        finalized.success = false;
+      }
+    }
+    ros::WallTime finalize_end = ros::WallTime::now();
+
+    struct stat output_stat;
+    if(finalized.frames > 0 && stat(finalized.path_to_output.c_str(), &output_stat) == 0 && output_stat.st_size > 0)
+      ROS_INFO_STREAM_NAMED(name_, "Compression ratio: " << (double)encoded_bytes / output_stat.st_size << " ("
+                            << output_stat.st_size / 1e6 << " MB written).");
+
+    finalized.finalize_duration = (finalize_end - finalize_start).toSec();
+    finalized.recording_duration = finalized.frames > 0 ? (finalize_end - first_arrival_time).toSec() : 0.0;
+    if(finalized.success)
+      ROS_INFO_STREAM_NAMED(name_, "Finalized " << finalized.path_to_output << " in " << finalized.finalize_duration
+                            << "s.");
+
+    metrics_pub_.publish(summary);
+    recording_finalized_pub_.publish(finalized);
+  }
+}
+
+void RecordingSession::imageCallback(const sensor_msgs::ImageConstPtr& input_image)
+{
+  ros::WallTime arrival_time = ros::WallTime::now();
+
+  // the sender numbers its images consecutively - a gap means that the images in between were dropped on the way. The
+  // sequence number is kept across recordings, so that a dropped first frame of a recording is detected as well. A
+  // restarted sender starts at a lower number, which is no loss 
+  const uint32_t seq_step = input_image->header.seq - last_image_seq_;
+  if(has_image_seq_ && seq_step > 1 && seq_step < 0x80000000u)
+    lost_frames_counter_ += seq_step - 1;
+  last_image_seq_ = input_image->header.seq;
+  has_image_seq_ = true;
+
+  // share the image with the message - only encodings that are not handled by the preprocessing stage are converted 
+  cv_bridge::CvImageConstPtr cv_image;
+  try
+  {
+    if(isConvertedInPreprocessing(input_image->encoding))
+      cv_image = cv_bridge::toCvShare(input_image);
+    else
+    {
+      cv_image = cv_bridge::toCvShare(input_image, sensor_msgs::image_encodings::BGR8);
+      conversion_copies_counter_++;
+    }
+  }
+  catch(cv_bridge::Exception& e)
+  {
+    ROS_ERROR_NAMED(name_, "Failed to convert sensor_msgs::Image to cv_bridge::CvImage : cv_bridge exception: %s",
+                    e.what());
+    lost_frames_counter_++;
+    publishCredits();
+    return;
+  }
+
+  if(cv_image->image.empty())
+  {
+    lost_frames_counter_++;
+    publishCredits();
+    return;
+  }
+
+  // size the ring from the first image - wait for images of a previous resolution to be processed before 
+  while(!image_ring_.isAllocatedFor(cv_image->image.size(), cv_image->image.type()))
+  {
+    if(!waitUntilDrained())
+      return;
+
+    // fails if the refill thread committed a frame in between 
+    boost::mutex::scoped_lock producer_lock(producer_mutex_);
+    frame_footprint_ = computeFrameFootprint(cv_image->image, cv_image->encoding, *getRenditions());
+    size_t capacity = std::max(static_cast<size_t>(2), static_cast<size_t>(memory_budget_ / frame_footprint_));
+    if(!image_ring_.allocate(capacity, cv_image->image.size(), cv_image->image.type()))
+      continue;
+    ROS_DEBUG_STREAM_NAMED(name_, "Allocated " << capacity << " frames of " << frame_footprint_ << " bytes.");
+    last_image_.reset();
+
+    if(spill_budget_ > 0. &&
+       !spill_file_.open(spill_path_, static_cast<size_t>(spill_budget_), cv_image->image.size(), cv_image->image.type()))
+      ROS_WARN_STREAM_NAMED(name_, "Could not create the spill file " << spill_path_ << ".");
+  }
+
+  // the first image of a recording selects the encoding passed to the encoders 
+  if(received_frames_counter_ == 0)
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    output_encoding_ = selectOutputEncoding(cv_image->encoding, cv_image->image.size());
+    ROS_DEBUG_STREAM_NAMED(name_, "Passing " << output_encoding_ << " frames to the encoders.");
+  }
+
+  // an image that equals the previous one - e.g. while the camera holds still - is neither copied nor encoded again 
+  bool is_duplicate = false;
+  if(duplicate_detection_row_step_ > 0)
+  {
+    // the hash skips rows - a match is confirmed by comparing all pixels with the previous image. The first image of
+    // a recording is never a duplicate, since the encoders of the recording have no frame to repeat 
+    uint64_t frame_hash = hashSampledRows(cv_image->image, duplicate_detection_row_step_);
+    is_duplicate = received_frames_counter_ > 0 && last_image_ && frame_hash == last_frame_hash_ &&
+                   cv_image->encoding == last_image_->encoding && isEqual(cv_image->image, last_image_->image);
+    last_frame_hash_ = frame_hash;
+    last_image_ = cv_image;
+  }
+  if(is_duplicate)
+    duplicate_frames_counter_++;
+
+  // spill the image to disk if the ring is full - block instead of dropping it if the spill file is full as well 
+  Frame* frame = nullptr;
+  bool is_spilled = false;
+  boost::unique_lock<boost::mutex> producer_lock(producer_mutex_);
+  while(true)
+  {
+    // as long as the spill file holds frames, newer frames have to queue up behind them 
+    if(spill_file_.empty() && (frame = image_ring_.acquireWriteSlot()))
+      break;
+    if(spill_file_.push(cv_image->image, cv_image->encoding, arrival_time,
+                        frame_number_offset_ + received_frames_counter_, is_duplicate))
+    {
+      is_spilled = true;
+      break;
+    }
+
+    ROS_DEBUG_STREAM_NAMED(name_, "Ring buffer full with " << bytes_in_flight_
+                           << " bytes in flight. Waiting for a free slot.");
+    producer_lock.unlock();
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      while(!(spill_file_.empty() ? image_ring_.freeSlots() > 0 : spill_file_.freeSlots() > 0) && !is_shutting_down_)
+        frame_released_condition_.wait(lock);
+
+      if(is_shutting_down_)
+        return;
+    }
+    producer_lock.lock();
+  }
+
+  if(!is_duplicate)
+    (is_spilled ? spill_copies_counter_ : ring_copies_counter_)++;
+  if(is_spilled)
+  {
+    if(received_frames_counter_ == 0)
+      first_arrival_time_ = arrival_time;
+    received_frames_counter_++;
+    producer_lock.unlock();
+    notify(frame_spilled_condition_);
+  }
+  else
+  {
+    if(!is_duplicate)
+      cv_image->image.copyTo(frame->image);
+    frame->is_duplicate = is_duplicate;
+    if(received_frames_counter_ == 0)
+      first_arrival_time_ = arrival_time;
+    frame->frame_number = frame_number_offset_ + received_frames_counter_++;
+    frame->encoding = cv_image->encoding;
+    frame->arrival_time = arrival_time;
+    frame->num_bytes = frame_footprint_;
+    bytes_in_flight_ += frame->num_bytes;
+    image_ring_.commitWriteSlot();
+    producer_lock.unlock();
+    worker_pool_->notify();
+  }
+
+  publishCredits();
+}
+
+void RecordingSession::refillImages()
+{
+  while(true)
+  {
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      while(!(!spill_file_.empty() && image_ring_.freeSlots() > 0) && !is_shutting_down_)
+        frame_spilled_condition_.wait(lock);
+
+      if(is_shutting_down_)
+        return;
+    }
+
+    {
+      // the ring has a single producer - the image callback must not commit a frame in between 
+      boost::mutex::scoped_lock producer_lock(producer_mutex_);
+      Frame* frame = image_ring_.acquireWriteSlot();
+      if(!frame || !spill_file_.pop(*frame))
+        continue;
+
+      if(!frame->is_duplicate)
+        spill_copies_counter_++;
+      frame->num_bytes = frame_footprint_;
+      bytes_in_flight_ += frame->num_bytes;
+      image_ring_.commitWriteSlot();
+    }
+    worker_pool_->notify();
+    // the freed record in the spill file may allow the producer to continue 
+    notify(frame_released_condition_);
+
+    publishCredits();
+  }
+}
+
+void RecordingSession::publishMetrics(const ros::WallTimerEvent& event)
+{
+  rviz_cinematographer_msgs::RecorderMetrics metrics;
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    ros::WallTime now = ros::WallTime::now();
+    metrics = collectMetrics(period_statistics_, (now - period_start_time_).toSec());
+    period_statistics_.reset();
+    period_start_time_ = now;
+  }
+  metrics_pub_.publish(metrics);
+}
+
+rviz_cinematographer_msgs::RecorderMetrics
+RecordingSession::collectMetrics(FrameStatistics& statistics, double duration)
+{
+  rviz_cinematographer_msgs::RecorderMetrics metrics;
+  statistics.fill(metrics, duration);
+  metrics.received_frames = received_frames_counter_;
+  metrics.duplicate_frames = duplicate_frames_counter_;
+  metrics.spilled_frames = spill_file_.spilledFrames();
+  metrics.frame_copies_ring = ring_copies_counter_;
+  metrics.frame_copies_spill = spill_copies_counter_;
+  metrics.frame_copies_segment = segment_copies_counter_;
+  metrics.frame_copies_retained = retained_copies_counter_;
+  metrics.frame_copies_conversion = conversion_copies_counter_;
+  metrics.frame_copies = metrics.frame_copies_ring + metrics.frame_copies_spill + metrics.frame_copies_segment +
+                         metrics.frame_copies_retained + metrics.frame_copies_conversion;
+  metrics.queue_depth = static_cast<uint32_t>(image_ring_.size());
+  metrics.spill_depth = static_cast<uint32_t>(spill_file_.size());
+  metrics.bytes_in_flight = bytes_in_flight_;
+  return metrics;
+}
+
+void RecordingSession::publishCredits()
+{
+  rviz_cinematographer_msgs::Credits credits;
+  // the ring is sized from the first image - until then, only one image is requested. The credits are capped to the
+  // images the subscriber's queue holds 
+  const size_t max_free_slots = rviz_cinematographer_msgs::Credits::MAX_FREE_SLOTS;
+  const size_t free_slots = image_ring_.capacity() > 0 ? image_ring_.freeSlots() + spill_file_.freeSlots() : 1;
+  credits.free_slots = static_cast<uint32_t>(std::min(free_slots, max_free_slots));
+  credits.received_frames = received_frames_counter_;
+  credits.lost_frames = lost_frames_counter_;
+  credits.recording_id = recording_id_;
+  credits_pub_.publish(credits);
+}
+
+boost::shared_ptr<EncoderBackend>
+RecordingSession::createEncoder(const rviz_cinematographer_msgs::Record& record_params) const
+{
+  if(record_params.lossless > 0)
+  {
+    FfmpegSettings settings = losslessFfmpegSettings((int)boost::thread::hardware_concurrency());
+    settings.executable = default_ffmpeg_settings_.executable;
+    return boost::make_shared<FfmpegEncoder>(settings);
+  }
+
+  if(record_params.encoder == rviz_cinematographer_msgs::Record::OPENCV)
+  {
+    if(record_params.compress > 0)
+      return boost::make_shared<OpenCvEncoder>(cv::VideoWriter::fourcc('D', 'I', 'V', 'X'));
+    else
+      return boost::make_shared<OpenCvEncoder>(cv::VideoWriter::fourcc('P', 'I', 'M', '1'));
+  }
+
+  if(record_params.encoder == rviz_cinematographer_msgs::Record::IMAGE_SEQUENCE)
+  {
+    std::string image_format = record_params.image_format.empty() ? "png" : record_params.image_format;
+    int png_compression_level = record_params.use_png_compression_level ? record_params.png_compression_level : 1;
+    return boost::make_shared<ImageSequenceEncoder>(image_format, png_compression_level);
+  }
+
+  if(record_params.encoder == rviz_cinematographer_msgs::Record::FFMPEG)
+  {
+    FfmpegSettings settings = default_ffmpeg_settings_;
+    if(!record_params.codec.empty())
+      settings.codec = record_params.codec;
+    if(!record_params.preset.empty())
+      settings.preset = record_params.preset;
+    if(record_params.use_crf)
+      settings.crf = record_params.crf;
+    if(!record_params.pixel_format.empty())
+      settings.pixel_format = record_params.pixel_format;
+    if(record_params.encoder_threads > 0)
+      settings.threads = record_params.encoder_threads;
+    return boost::make_shared<FfmpegEncoder>(settings);
+  }
+
+  return boost::shared_ptr<EncoderBackend>();
+}
+
+std::string RecordingSession::selectOutputEncoding(const std::string& encoding, const cv::Size& image_size)
+{
+  std::vector<boost::shared_ptr<EncoderBackend> > encoders;
+  if(encoder_)
+    encoders.push_back(encoder_);
+  for(const Rendition& rendition : *renditions_)
+    encoders.push_back(rendition.encoder);
+
+  // YUV 4:2:0 subsamples the chroma in 2x2 blocks 
+  const cv::Size output_size = output_size_.area() > 0 ? output_size_ : image_size;
+  bool has_even_sizes = output_size.width % 2 == 0 && output_size.height % 2 == 0;
+  for(const Rendition& rendition : *renditions_)
+  {
+    const cv::Size size = renditionSize(rendition.size, output_size);
+    has_even_sizes = has_even_sizes && size.width % 2 == 0 && size.height % 2 == 0;
+  }
+
+  // converting to the codec's YUV in the workers relieves the encoders the most, passing the received images on 
+  // without converting them to BGR still saves a pass 
+  std::vector<std::string> candidates;
+  if(has_even_sizes)
+    candidates.push_back(YUV420P);
+  candidates.push_back(encoding);
+
+  for(const std::string& candidate : candidates)
+  {
+    bool is_taken = !encoders.empty();
+    for(const boost::shared_ptr<EncoderBackend>& encoder : encoders)
+      is_taken = encoder->setInputEncoding(candidate) && is_taken;
+    if(is_taken)
+      return candidate;
+  }
+
+  for(const boost::shared_ptr<EncoderBackend>& encoder : encoders)
+    encoder->setInputEncoding(sensor_msgs::image_encodings::BGR8);
+  return sensor_msgs::image_encodings::BGR8;
+}
+
+size_t RecordingSession::computeFrameFootprint(const cv::Mat& image, const std::string& encoding,
+                                               const std::vector<Rendition>& renditions) const
+{
+  const size_t bgr_pixel_bytes = 3;
+  size_t footprint = image.total() * image.elemSize();
+
+  if(encoding != sensor_msgs::image_encodings::BGR8)
+    footprint += image.total() * bgr_pixel_bytes;
+
+  if(output_size_.area() > 0 && image.size() != output_size_)
+    footprint += static_cast<size_t>(output_size_.area()) * bgr_pixel_bytes;
+
+  cv::Size output_size = output_size_.area() > 0 ? output_size_ : image.size();
+  for(const Rendition& rendition : renditions)
+    footprint += static_cast<size_t>(renditionSize(rendition.size, output_size).area()) * bgr_pixel_bytes;
+
+  return footprint;
+}
+
+boost::shared_ptr<const std::vector<Rendition> > RecordingSession::getRenditions()
+{
+  boost::mutex::scoped_lock lock(pipeline_mutex_);
+  return renditions_;
+}
+
+void RecordingSession::notify(boost::condition_variable& condition)
+{
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+  }
+  condition.notify_all();
+}
+
+bool RecordingSession::waitUntilDrained()
+{
+  boost::mutex::scoped_lock lock(pipeline_mutex_);
+  while(!(image_ring_.empty() && spill_file_.empty()) && !is_shutting_down_)
+    frame_released_condition_.wait(lock);
+  return !is_shutting_down_;
+}
+
+bool RecordingSession::hasTask()
+{
+  return image_ring_.hasClaimableSlot(static_cast<size_t>(max_preprocessed_frames_));
+}
+
+size_t RecordingSession::taskCost()
+{
+  return frame_footprint_;
+}
+
+bool RecordingSession::runTask()
+{
+  Frame* frame = image_ring_.claimSlot(static_cast<size_t>(max_preprocessed_frames_));
+  if(!frame)
+    return false;
+
+  preprocessImage(*frame);
+  encodeInWorker(*frame);
+  frame->is_preprocessed.store(true, std::memory_order_release);
+  notify(frame_preprocessed_condition_);
+  return true;
+}
+
+void RecordingSession::preprocessImage(Frame& frame)
+{
+  frame.conversion_duration = 0.0;
+  frame.watermark_duration = 0.0;
+
+  // the writer stage repeats the previous frame 
+  if(frame.is_duplicate)
+    return;
+
+  ros::WallTime start = ros::WallTime::now();
+  cv::Mat* image = &frame.image;
+
+  std::string output_encoding;
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    output_encoding = output_encoding_;
+  }
+
+  // images the encoders or the conversion to YUV take as they are stay in their encoding 
+  std::string color_encoding = output_encoding;
+  if(output_encoding == YUV420P)
+    color_encoding = YuvConverter::isConvertible(frame.encoding) ? frame.encoding : sensor_msgs::image_encodings::BGR8;
+
+  if(frame.encoding != sensor_msgs::image_encodings::BGR8 && frame.encoding != color_encoding)
+  {
+    if(frame.encoding == sensor_msgs::image_encodings::RGB8)
+      cv::cvtColor(*image, frame.converted, cv::COLOR_RGB2BGR);
+    else if(frame.encoding == sensor_msgs::image_encodings::BGRA8)
+      cv::cvtColor(*image, frame.converted, cv::COLOR_BGRA2BGR);
+    else if(frame.encoding == sensor_msgs::image_encodings::RGBA8)
+      cv::cvtColor(*image, frame.converted, cv::COLOR_RGBA2BGR);
+    else if(frame.encoding == sensor_msgs::image_encodings::MONO8)
+      cv::cvtColor(*image, frame.converted, cv::COLOR_GRAY2BGR);
+    image = &frame.converted;
+  }
+
+  if(output_size_.area() > 0 && image->size() != output_size_)
+  {
+    cv::resize(*image, frame.resized, output_size_, 0, 0, cv::INTER_AREA);
+    image = &frame.resized;
+  }
+
+  frame.output = *image;
+
+  // downscale the renditions from largest to smallest, each from the smallest image computed so far that is larger 
+  boost::shared_ptr<const std::vector<Rendition> > renditions = getRenditions();
+  std::vector<cv::Size> rendition_sizes;
+  std::vector<size_t> pyramid_order;
+  for(size_t i = 0; i < renditions->size(); ++i)
+  {
+    rendition_sizes.push_back(renditionSize(renditions->at(i).size, frame.output.size()));
+    pyramid_order.push_back(i);
+  }
+  std::sort(pyramid_order.begin(), pyramid_order.end(), [&rendition_sizes](size_t a, size_t b)
+            { return rendition_sizes[a].area() > rendition_sizes[b].area(); });
+
+  frame.renditions.resize(renditions->size());
+  frame.downscaled.resize(renditions->size());
+  const cv::Mat* pyramid_level = &frame.output;
+  for(size_t i : pyramid_order)
+  {
+    const cv::Size& size = rendition_sizes[i];
+    if(size.width > pyramid_level->cols || size.height > pyramid_level->rows)
+      cv::resize(frame.output, frame.downscaled[i], size, 0, 0, cv::INTER_LINEAR);
+    else
+    {
+      cv::resize(*pyramid_level, frame.downscaled[i], size, 0, 0, cv::INTER_AREA);
+      pyramid_level = &frame.downscaled[i];
+    }
+    frame.renditions[i] = frame.downscaled[i];
+  }
+
+  ros::WallTime converted = ros::WallTime::now();
+  frame.conversion_duration = (converted - start).toSec();
+
+  // the watermark is added last, so that it is not scaled down into the renditions 
+  if(add_watermark_)
+  {
+    boost::shared_ptr<const WatermarkBlender> watermark_blender = getWatermarkBlender(frame.output.cols,
+                                                                                      color_encoding);
+    if(watermark_blender)
+      watermark_blender->apply(frame.output);
+  }
+  for(size_t i = 0; i < renditions->size(); ++i)
+  {
+    if(!renditions->at(i).add_watermark)
+      continue;
+    boost::shared_ptr<const WatermarkBlender> watermark_blender = getWatermarkBlender(frame.renditions[i].cols,
+                                                                                      color_encoding);
+    if(watermark_blender)
+      watermark_blender->apply(frame.renditions[i]);
+  }
+  ros::WallTime watermarked = ros::WallTime::now();
+  frame.watermark_duration = (watermarked - converted).toSec();
+
+  // encoders that take YUV 4:2:0 get it from the workers instead of converting the frames in their single thread 
+  if(output_encoding == YUV420P)
+  {
+    YuvConverter::convert(frame.output, color_encoding, frame.yuv);
+    frame.output = frame.yuv;
+
+    frame.yuv_renditions.resize(frame.renditions.size());
+    for(size_t i = 0; i < frame.renditions.size(); ++i)
+    {
+      YuvConverter::convert(frame.renditions[i], color_encoding, frame.yuv_renditions[i]);
+      frame.renditions[i] = frame.yuv_renditions[i];
+    }
+    frame.conversion_duration += (ros::WallTime::now() - watermarked).toSec();
+  }
+}
+
+void RecordingSession::encodeInWorker(Frame& frame)
+{
+  frame.is_encoded = false;
+  if(frame.is_duplicate)
+    return;
+
+  boost::shared_ptr<EncoderBackend> encoder;
+  {
+    boost::mutex::scoped_lock lock(pipeline_mutex_);
+    if(!encoder_ || !encoder_->encodesInWorkers())
+      return;
+
+    encoder = encoder_;
+    if(!encoder->isOpened())
+      if(!encoder->open(path_to_output_, target_fps_, frame.output.size()))
+        ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, "Could not open the output to write files in : "
+                                        << path_to_output_);
+  }
+
+  // the file name is derived from the frame number, so frames can be written in any order 
+  ros::WallTime start = ros::WallTime::now();
+  if(encoder->isOpened() && !encoder->writeFrame(frame.output, frame.frame_number))
+    ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, encoder->name() << " failed to write frame " << frame.frame_number
+                                    << ".");
+
+  frame.encode_duration = (ros::WallTime::now() - start).toSec();
+  frame.is_encoded = true;
+}
+
+void RecordingSession::writeImages()
+{
+  size_t frame_bytes = 0;
+  while(true)
+  {
+    // frames are written strictly in the order they were received 
+    Frame* frame = nullptr;
+    boost::shared_ptr<EncoderBackend> encoder;
+    boost::shared_ptr<const std::vector<Rendition> > renditions;
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      while(!((frame = image_ring_.acquireReadSlot()) && frame->is_preprocessed.load(std::memory_order_acquire)) &&
+            !is_shutting_down_)
+        frame_preprocessed_condition_.wait(lock);
+
+      if(is_shutting_down_)
+        return;
+
+      // open the encoder while locked, so that the record parameters can't change in between 
+      encoder = encoder_;
+      if(encoder && !frame->is_encoded && !encoder->isOpened())
+        if(!encoder->open(path_to_output_, target_fps_, frame->output.size()))
+          ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, "Could not open the output video to write file in : "
+                                          << path_to_output_);
+
+      renditions = renditions_;
+      for(size_t i = 0; i < renditions->size() && i < frame->renditions.size(); ++i)
+      {
+        const Rendition& rendition = renditions->at(i);
+        if(!frame->is_duplicate && !rendition.encoder->isOpened())
+          if(!rendition.encoder->open(rendition.path_to_output, target_fps_, frame->renditions[i].size()))
+            ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, "Could not open the rendition to write file in : "
+                                            << rendition.path_to_output);
+      }
+    }
+
+    ros::WallTime start = ros::WallTime::now();
+    double arrival_to_write_duration = (start - frame->arrival_time).toSec();
+
+    double encode_duration = frame->is_encoded ? frame->encode_duration : 0.0;
+    if(frame->is_duplicate)
+    {
+      // repeat the last frame - backends that can't do so without the image data get the kept copy of it 
+      bool is_written = false;
+      if(encoder && encoder->isOpened())
+      {
+        if(encoder->canWriteDuplicates())
+          is_written = encoder->writeDuplicate(frame->frame_number);
+        else if(!last_output_.empty())
+        {
+          is_written = encoder->write(last_output_);
+          if(encoder->copiesFrames())
+            segment_copies_counter_++;
+        }
+      }
+      if(!is_written)
+        ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, "Failed to repeat the previous frame for frame "
+                                        << frame->frame_number << ".");
+
+      for(size_t i = 0; i < renditions->size() && i < last_renditions_.size(); ++i)
+        if(renditions->at(i).encoder->isOpened())
+          renditions->at(i).encoder->write(last_renditions_[i]);
+      encode_duration = (ros::WallTime::now() - start).toSec();
+    }
+    else
+    {
+      if(!frame->is_encoded)
+      {
+        if(encoder && encoder->isOpened())
+        {
+          if(!encoder->write(frame->output))
+            ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, encoder->name() << " failed to write a frame.");
+          if(encoder->copiesFrames())
+            segment_copies_counter_++;
+        }
+      }
+      for(size_t i = 0; i < renditions->size() && i < frame->renditions.size(); ++i)
+        if(renditions->at(i).encoder->isOpened() && !renditions->at(i).encoder->write(frame->renditions[i]))
+          ROS_ERROR_STREAM_THROTTLE_NAMED(1.0, name_, "Failed to write into " << renditions->at(i).path_to_output
+                                          << ".");
+      encode_duration += (ros::WallTime::now() - start).toSec();
+      frame_bytes = frame->output.total() * frame->output.elemSize();
+
+      // keep the frame if the next frame repeats it or if it is not received yet - without duplicate detection, no
+      // frame can repeat it. The images are taken over from the slot, it only gets the previously kept buffers back 
+      Frame* next_frame = image_ring_.peekReadSlot(1);
+      if(duplicate_detection_row_step_ > 0 && (!next_frame || next_frame->is_duplicate))
+      {
+        if(encoder && !encoder->canWriteDuplicates() &&
+           !retainImage(frame->output, {&frame->image, &frame->converted, &frame->resized, &frame->yuv}, last_output_))
+        {
+          frame->output.copyTo(last_output_);
+          retained_copies_counter_++;
+        }
+        last_renditions_.resize(frame->renditions.size());
+        frame->yuv_renditions.resize(frame->renditions.size());
+        for(size_t i = 0; i < frame->renditions.size(); ++i)
+        {
+          if(!retainImage(frame->renditions[i], {&frame->downscaled[i], &frame->yuv_renditions[i]},
+                          last_renditions_[i]))
+          {
+            frame->renditions[i].copyTo(last_renditions_[i]);
+            retained_copies_counter_++;
+          }
+        }
+      }
+    }
+
+    double conversion_duration = frame->conversion_duration;
+    double watermark_duration = frame->watermark_duration;
+    frame->is_preprocessed.store(false, std::memory_order_relaxed);
+    bytes_in_flight_ -= frame->num_bytes;
+    image_ring_.releaseReadSlot();
+
+    {
+      boost::mutex::scoped_lock lock(pipeline_mutex_);
+      encoded_bytes_ += frame_bytes;
+      recording_statistics_.add(conversion_duration, watermark_duration, encode_duration, arrival_to_write_duration);
+      period_statistics_.add(conversion_duration, watermark_duration, encode_duration, arrival_to_write_duration);
+    }
+    // a released slot may allow the producer and the refill thread to continue and the workers to claim further frames 
+    frame_released_condition_.notify_all();
+    worker_pool_->notify();
+    frame_spilled_condition_.notify_all();
+
+    publishCredits();
+  }
+}
+
+boost::shared_ptr<const WatermarkBlender> RecordingSession::getWatermarkBlender(const int image_width,
+                                                                                const std::string& encoding)
+{
+  boost::mutex::scoped_lock lock(watermark_mutex_);
+
+  // resize watermark and compute its blend table only once per recording, resolution and encoding 
+  boost::shared_ptr<const WatermarkBlender>& watermark_blender = watermark_blenders_[std::make_pair(image_width,
+                                                                                                   encoding)];
+  if(!watermark_blender && !original_watermark_.empty())
+  {
+    cv::Mat resized_watermark;
+    original_watermark_.copyTo(resized_watermark);
+    resizeWatermark(resized_watermark, image_width);
+
+    // the blender takes the channel order of the images from the watermark 
+    const bool is_rgb = encoding == sensor_msgs::image_encodings::RGB8 ||
+                        encoding == sensor_msgs::image_encodings::RGBA8;
+    if(is_rgb)
+      cv::cvtColor(resized_watermark, resized_watermark, cv::COLOR_BGRA2RGBA);
+    watermark_blender = boost::make_shared<const WatermarkBlender>(resized_watermark,
+                                                                   sensor_msgs::image_encodings::numChannels(encoding));
+    ROS_DEBUG_STREAM_NAMED(name_, "Blending watermark with " << WatermarkBlender::kernelName() << " kernel.");
+  }
+
+  return watermark_blender;
+}
+
+void RecordingSession::resizeWatermark(cv::Mat& watermark, const int image_width)
+{
+  float watermark_resize_factor = (0.5f * image_width) / watermark.cols;
+  if(watermark_resize_factor < 1.f)
+    cv::resize(watermark, watermark, cv::Size(), watermark_resize_factor, watermark_resize_factor);
+}
+
+}
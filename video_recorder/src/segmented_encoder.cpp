@@ -0,0 +1,301 @@
+/** @file
+ *
+ * Encoder that cuts the video into segments which are encoded concurrently and concatenated afterwards.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/segmented_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+namespace video_recorder
+{
+
+SegmentedEncoder::SegmentedEncoder(const EncoderFactory& encoder_factory, int segment_length,
+                                   int max_parallel_segments, size_t max_queued_bytes,
+                                   const std::string& ffmpeg_executable)
+  : encoder_factory_(encoder_factory)
+    , segment_length_(std::max(1, segment_length))
+    , max_parallel_segments_(std::max(1, max_parallel_segments))
+    , max_queued_bytes_(max_queued_bytes)
+    , ffmpeg_executable_(ffmpeg_executable)
+    , is_resumable_(false)
+    , input_encoding_("bgr8")
+    , first_segment_index_(0)
+    , fps_(0.0)
+    , is_opened_(false)
+    , frames_in_segment_(0)
+    , queued_bytes_(0)
+    , has_failed_(false)
+{
+}
+
+SegmentedEncoder::~SegmentedEncoder()
+{
+  release();
+}
+
+bool SegmentedEncoder::setInputEncoding(const std::string& encoding)
+{
+  // the segments' encoders are created later - ask a probe instance whether they take the encoding
+  boost::shared_ptr<EncoderBackend> encoder = encoder_factory_();
+  if(!encoder || !encoder->setInputEncoding(encoding))
+    return false;
+
+  input_encoding_ = encoding;
+  return true;
+}
+
+void SegmentedEncoder::enableResuming(size_t first_segment_index)
+{
+  is_resumable_ = true;
+  first_segment_index_ = first_segment_index;
+}
+
+bool SegmentedEncoder::open(const std::string& path, double fps, const cv::Size& size)
+{
+  release();
+
+  path_ = path;
+  path_prefix_ = stripExtension(path);
+  extension_ = path.substr(path_prefix_.size());
+  fps_ = fps;
+  size_ = size;
+  has_failed_ = false;
+  is_opened_ = true;
+  return true;
+}
+
+bool SegmentedEncoder::isOpened() const
+{
+  return is_opened_;
+}
+
+bool SegmentedEncoder::write(const cv::Mat& image)
+{
+  if(!is_opened_)
+    return false;
+
+  if(segments_.empty() || frames_in_segment_ >= segment_length_)
+  {
+    if(!segments_.empty())
+      completeSegment();
+    startSegment();
+  }
+
+  // block if the segments' encoders fall behind too far - the bytes are reserved before the frame is copied
+  const size_t image_bytes = image.total() * image.elemSize();
+  cv::Mat queued_image;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(queued_bytes_ > 0 && queued_bytes_ + image_bytes > max_queued_bytes_)
+      condition_.wait(lock);
+
+    queued_bytes_ += image_bytes;
+    if(!free_images_.empty())
+    {
+      queued_image = free_images_.back();
+      free_images_.pop_back();
+    }
+  }
+
+  // the frame is copied into the buffer of an encoded frame without holding the lock instead of allocating a new one
+  image.copyTo(queued_image);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  segments_.back()->queue.push_back(queued_image);
+  frames_in_segment_++;
+  condition_.notify_all();
+  return !has_failed_;
+}
+
+bool SegmentedEncoder::release()
+{
+  if(!is_opened_)
+    return true;
+
+  if(!segments_.empty())
+    completeSegment();
+  for(const boost::shared_ptr<Segment>& segment : segments_)
+    segment->thread->join();
+
+  // keep the segment files if encoding failed, so that the encoded frames are not lost
+  if(!segments_.empty() && !has_failed_)
+    has_failed_ = !concatenateSegments();
+
+  segments_.clear();
+  free_images_.clear();
+  frames_in_segment_ = 0;
+  queued_bytes_ = 0;
+  is_opened_ = false;
+  return !has_failed_;
+}
+
+std::string SegmentedEncoder::name() const
+{
+  boost::shared_ptr<EncoderBackend> encoder = encoder_factory_();
+  return "segmented " + (encoder ? encoder->name() : std::string("encoder"));
+}
+
+std::string SegmentedEncoder::segmentPath(size_t segment_index) const
+{
+  std::ostringstream path;
+  path << path_prefix_ << "_segment_" << std::setw(4) << std::setfill('0') << segment_index << extension_;
+  return path.str();
+}
+
+std::string SegmentedEncoder::progressPath() const
+{
+  return path_prefix_ + "_progress.yaml";
+}
+
+void SegmentedEncoder::startSegment()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while(true)
+  {
+    int num_encoding_segments = 0;
+    for(const boost::shared_ptr<Segment>& segment : segments_)
+      if(!segment->is_finished)
+        num_encoding_segments++;
+    if(num_encoding_segments < max_parallel_segments_)
+      break;
+    condition_.wait(lock);
+  }
+
+  boost::shared_ptr<Segment> segment = boost::make_shared<Segment>();
+  segment->encoder = encoder_factory_();
+  if(segment->encoder)
+    segment->encoder->setInputEncoding(input_encoding_);
+  segment->thread = boost::make_shared<boost::thread>(
+    boost::bind(&SegmentedEncoder::encodeSegment, this, segment, first_segment_index_ + segments_.size()));
+  segments_.push_back(segment);
+  frames_in_segment_ = 0;
+}
+
+void SegmentedEncoder::completeSegment()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  segments_.back()->is_complete = true;
+  condition_.notify_all();
+}
+
+void SegmentedEncoder::encodeSegment(boost::shared_ptr<Segment> segment, size_t segment_index)
+{
+  // a new encoder instance per segment starts the segment with a key frame
+  bool is_opened = segment->encoder && segment->encoder->open(segmentPath(segment_index), fps_, size_);
+  bool has_failed = !is_opened;
+
+  cv::Mat image;
+  while(true)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // hand the buffer of the encoded frame back to write() as long as it fits into the budget next to the queue 
+      const size_t image_bytes = image.total() * image.elemSize();
+      if(!image.empty() && queued_bytes_ + (free_images_.size() + 1) * image_bytes <= max_queued_bytes_)
+        free_images_.push_back(image);
+      image.release();
+
+      while(segment->queue.empty() && !segment->is_complete)
+        condition_.wait(lock);
+
+      if(segment->queue.empty())
+        break;
+
+      image = segment->queue.front();
+      segment->queue.pop_front();
+      queued_bytes_ -= image.total() * image.elemSize();
+    }
+    condition_.notify_all();
+
+    // keep dequeuing after a failure, so that the writer never blocks on a full queue
+    if(is_opened && !segment->encoder->write(image))
+      has_failed = true;
+    else if(is_opened)
+      segment->num_frames++;
+  }
+
+  if(is_opened && !segment->encoder->release())
+    has_failed = true;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  segment->is_finished = true;
+  segment->has_failed = has_failed;
+  has_failed_ = has_failed_ || has_failed;
+  if(is_resumable_)
+    writeProgress();
+  condition_.notify_all();
+}
+
+void SegmentedEncoder::writeProgress()
+{
+  // segments may finish out of order - only the leading finished segments count
+  size_t committed_frames = first_segment_index_ * segment_length_;
+  for(const boost::shared_ptr<Segment>& segment : segments_)
+  {
+    if(!segment->is_finished || segment->has_failed)
+      break;
+    committed_frames += segment->num_frames;
+  }
+
+  // replace the progress file atomically, so that it is never read half-written after a crash
+  const std::string temporary_path = progressPath() + ".tmp";
+  {
+    std::ofstream progress(temporary_path.c_str());
+    progress << "# Frames written into finished segments - resume the recording with start_frame = committed_frames\n"
+             << "committed_frames: " << committed_frames << "\n"
+             << "segment_length: " << segment_length_ << "\n";
+    if(!progress)
+      return;
+  }
+  std::rename(temporary_path.c_str(), progressPath().c_str());
+}
+
+bool SegmentedEncoder::concatenateSegments()
+{
+  // the segments of an interrupted recording are concatenated as well
+  const size_t num_segments = first_segment_index_ + segments_.size();
+  if(num_segments == 1)
+    return std::rename(segmentPath(0).c_str(), path_.c_str()) == 0;
+
+  // the concat demuxer resolves relative paths relative to the list, which is next to the segments
+  const std::string list_path = path_prefix_ + "_segments.txt";
+  {
+    std::ofstream list(list_path.c_str());
+    for(size_t i = 0; i < num_segments; ++i)
+    {
+      std::string segment_path = segmentPath(i);
+      size_t file_name_start = segment_path.find_last_of('/');
+      if(file_name_start != std::string::npos)
+        segment_path = segment_path.substr(file_name_start + 1);
+      list << "file " << shellQuote(segment_path) << "\n";
+    }
+    if(!list)
+      return false;
+  }
+
+  std::ostringstream command;
+  command << shellQuote(ffmpeg_executable_) << " -y -loglevel error -f concat -safe 0 -i " << shellQuote(list_path)
+          << " -c copy " << shellQuote(path_);
+  if(std::system(command.str().c_str()) != 0)
+    return false;
+
+  for(size_t i = 0; i < num_segments; ++i)
+    std::remove(segmentPath(i).c_str());
+  std::remove(list_path.c_str());
+  std::remove(progressPath().c_str());
+  return true;
+}
+
+}  // namespace video_recorder
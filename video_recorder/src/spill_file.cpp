@@ -0,0 +1,229 @@
+/** @file
+ *
+ * Memory-mapped ring file that takes the frames which do not fit into the in-memory ring buffer.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/spill_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace video_recorder
+{
+
+SpillFile::SpillFile()
+  : file_descriptor_(-1)
+    , data_(nullptr)
+    , record_bytes_(0)
+    , image_type_(-1)
+    , head_(0)
+    , tail_(0)
+    , released_bytes_(0)
+    , spilled_frames_(0)
+    , max_size_(0)
+{
+}
+
+SpillFile::~SpillFile()
+{
+  close();
+}
+
+bool SpillFile::open(const std::string& path, size_t max_bytes, const cv::Size& size, int type)
+{
+  close();
+
+  boost::mutex::scoped_lock lock(mutex_);
+  const size_t record_bytes = size.area() * CV_ELEM_SIZE(type);
+  const size_t capacity = record_bytes > 0 ? max_bytes / record_bytes : 0;
+  if(capacity == 0)
+    return false;
+
+  int file_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(file_descriptor < 0)
+    return false;
+
+  // reserve the disk space up front, so that writing into the mapping can not fail on a full disk later
+  const size_t file_bytes = capacity * record_bytes;
+  if(posix_fallocate(file_descriptor, 0, file_bytes) != 0)
+  {
+    ::close(file_descriptor);
+    unlink(path.c_str());
+    return false;
+  }
+
+  void* data = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+  if(data == MAP_FAILED)
+  {
+    ::close(file_descriptor);
+    unlink(path.c_str());
+    return false;
+  }
+
+  path_ = path;
+  file_descriptor_ = file_descriptor;
+  data_ = static_cast<unsigned char*>(data);
+  record_bytes_ = record_bytes;
+  image_size_ = size;
+  image_type_ = type;
+  records_.assign(capacity, Record());
+  head_ = 0;
+  tail_ = 0;
+  released_bytes_ = 0;
+  return true;
+}
+
+void SpillFile::close()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if(data_)
+    munmap(data_, records_.size() * record_bytes_);
+  if(file_descriptor_ >= 0)
+  {
+    ::close(file_descriptor_);
+    unlink(path_.c_str());
+  }
+
+  file_descriptor_ = -1;
+  data_ = nullptr;
+  records_.clear();
+  head_ = 0;
+  tail_ = 0;
+  released_bytes_ = 0;
+}
+
+bool SpillFile::isOpen() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return data_ != nullptr;
+}
+
+bool SpillFile::push(const cv::Mat& image, const std::string& encoding, const ros::WallTime& arrival_time,
+                     uint64_t frame_number, bool is_duplicate)
+{
+  size_t index = 0;
+  unsigned char* record = nullptr;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if(!data_ || head_ - tail_ >= records_.size() || image.size() != image_size_ || image.type() != image_type_)
+      return false;
+
+    index = head_ % records_.size();
+    record = data_ + index * record_bytes_;
+  }
+
+  // the record at head_ is reserved for the single pushing thread until head_ is advanced - it is copied without
+  // holding the lock, so that size() and freeSlots() don't wait for the copy 
+  const size_t row_bytes = image.cols * image.elemSize();
+  if(!is_duplicate)
+    for(int row = 0; row < image.rows; ++row)
+      std::memcpy(record + row * row_bytes, image.ptr(row), row_bytes);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  records_[index].encoding = encoding;
+  records_[index].arrival_time = arrival_time;
+  records_[index].frame_number = frame_number;
+  records_[index].is_duplicate = is_duplicate;
+  head_++;
+
+  spilled_frames_++;
+  max_size_ = std::max(max_size_, head_ - tail_);
+  return true;
+}
+
+bool SpillFile::pop(Frame& frame)
+{
+  size_t index = 0;
+  size_t capacity = 0;
+  unsigned char* record = nullptr;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if(!data_ || head_ == tail_)
+      return false;
+
+    capacity = records_.size();
+    index = tail_ % capacity;
+    record = data_ + index * record_bytes_;
+    frame.encoding = records_[index].encoding;
+    frame.arrival_time = records_[index].arrival_time;
+    frame.frame_number = records_[index].frame_number;
+    frame.is_duplicate = records_[index].is_duplicate;
+  }
+
+  // the record at tail_ can not be overwritten by push() until tail_ is advanced - it is copied without holding the
+  // lock like in push() 
+  if(!frame.is_duplicate)
+    cv::Mat(image_size_, image_type_, record).copyTo(frame.image);
+  releasePages(index, capacity);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  tail_++;
+  return true;
+}
+
+void SpillFile::releasePages(size_t index, size_t capacity)
+{
+  // the pages are not needed until the records are overwritten - drop them from the resident memory of the process.
+  // Records don't start at page boundaries, so only the pages up to the last one that lies completely within the
+  // popped records are dropped - the page that the record shares with the next one follows with the next record. The
+  // last page of the file is dropped with the last record, before the ring wraps around to the start of the file.
+  const size_t page_bytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = index == 0 ? 0 : released_bytes_;
+  size_t end = (index + 1) * record_bytes_;
+  if(index + 1 == capacity)
+    end = (end + page_bytes - 1) / page_bytes * page_bytes;
+  else
+    end = end / page_bytes * page_bytes;
+
+  if(end <= begin)
+    return;
+
+  // the mapping starts at a page boundary, so are begin and end 
+  madvise(data_ + begin, end - begin, MADV_DONTNEED);
+  released_bytes_ = end;
+}
+
+size_t SpillFile::size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return head_ - tail_;
+}
+
+size_t SpillFile::capacity() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return records_.size();
+}
+
+size_t SpillFile::freeSlots() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return records_.size() - (head_ - tail_);
+}
+
+uint64_t SpillFile::spilledFrames() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return spilled_frames_;
+}
+
+size_t SpillFile::maxSize() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return max_size_;
+}
+
+void SpillFile::resetStatistics()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  spilled_frames_ = 0;
+  max_size_ = head_ - tail_;
+}
+
+}  // namespace video_recorder
@@ -0,0 +1,178 @@
+/** @file
+ *
+ * Vectorized alpha blending of a watermark into video frames.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/watermark_blender.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VIDEO_RECORDER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace video_recorder
+{
+
+typedef void (*BlendKernel)(uint8_t* image, const uint8_t* weights, const uint8_t* premultiplied, size_t num_bytes);
+
+// image = round(image * weight / 255) + premultiplied for each byte
+static void blendScalar(uint8_t* image, const uint8_t* weights, const uint8_t* premultiplied, size_t num_bytes)
+{
+  for(size_t i = 0; i < num_bytes; ++i)
+  {
+    unsigned int t = image[i] * weights[i] + 128u;
+    image[i] = static_cast<uint8_t>(((t + (t >> 8)) >> 8) + premultiplied[i]);
+  }
+}
+
+#ifdef VIDEO_RECORDER_X86_KERNELS
+__attribute__((target("sse2")))
+static void blendSSE2(uint8_t* image, const uint8_t* weights, const uint8_t* premultiplied, size_t num_bytes)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+
+  size_t i = 0;
+  for(; i + 16 <= num_bytes; i += 16)
+  {
+    __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image + i));
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i));
+    __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(premultiplied + i));
+
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(w, zero)), bias);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(w, zero)), bias);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(image + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), p));
+  }
+
+  blendScalar(image + i, weights + i, premultiplied + i, num_bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void blendAVX2(uint8_t* image, const uint8_t* weights, const uint8_t* premultiplied, size_t num_bytes)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bias = _mm256_set1_epi16(128);
+
+  // unpack and pack work on both 128-bit lanes independently, so the byte order is preserved
+  size_t i = 0;
+  for(; i + 32 <= num_bytes; i += 32)
+  {
+    __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image + i));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+    __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(premultiplied + i));
+
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero),
+                                                     _mm256_unpacklo_epi8(w, zero)), bias);
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero),
+                                                     _mm256_unpackhi_epi8(w, zero)), bias);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(image + i), _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), p));
+  }
+
+  blendSSE2(image + i, weights + i, premultiplied + i, num_bytes - i);
+}
+#endif
+
+// Picks the fastest kernel the CPU supports
+static BlendKernel selectBlendKernel(const char** name)
+{
+#ifdef VIDEO_RECORDER_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+  {
+    *name = "AVX2";
+    return blendAVX2;
+  }
+  if(__builtin_cpu_supports("sse2"))
+  {
+    *name = "SSE2";
+    return blendSSE2;
+  }
+#endif
+  *name = "scalar";
+  return blendScalar;
+}
+
+static const char* blend_kernel_name = "";
+static const BlendKernel blend_kernel = selectBlendKernel(&blend_kernel_name);
+
+WatermarkBlender::WatermarkBlender(const cv::Mat& watermark, int channels, float opacity)
+  : rows_(watermark.rows)
+    , cols_(watermark.cols)
+    , channels_(channels)
+{
+  CV_Assert(watermark.type() == CV_8UC4 && (channels == 3 || channels == 4));
+
+  const uint8_t image_weight = cv::saturate_cast<uint8_t>((1.f - opacity) * 255.f);
+  const float watermark_weight = (255 - image_weight) / 255.f;
+
+  // transparent pixels keep the image as is
+  weights_.assign(static_cast<size_t>(rows_) * cols_ * channels_, 255);
+  premultiplied_.assign(weights_.size(), 0);
+
+  for(int row = 0; row < rows_; ++row)
+  {
+    const cv::Vec4b* watermark_row = watermark.ptr<cv::Vec4b>(row);
+    int begin_col = cols_;
+    int end_col = 0;
+    for(int col = 0; col < cols_; ++col)
+    {
+      if(watermark_row[col][3] == 0)
+        continue;
+
+      begin_col = std::min(begin_col, col);
+      end_col = col + 1;
+
+      size_t index = (static_cast<size_t>(row) * cols_ + col) * channels_;
+      for(int i = 0; i < 3; ++i)
+      {
+        weights_[index + i] = image_weight;
+        premultiplied_[index + i] = cv::saturate_cast<uint8_t>(watermark_weight * watermark_row[col][i]);
+      }
+    }
+
+    if(end_col > begin_col)
+    {
+      RowSpan span;
+      span.row = row;
+      span.begin_col = begin_col;
+      span.end_col = end_col;
+      spans_.push_back(span);
+    }
+  }
+}
+
+void WatermarkBlender::apply(cv::Mat& image) const
+{
+  CV_Assert(image.depth() == CV_8U && image.channels() == channels_);
+
+  const int origin_row = image.rows - rows_;
+  const int origin_col = image.cols - cols_;
+  if(origin_col < 0)
+    return;
+
+  for(const auto& span : spans_)
+  {
+    if(origin_row + span.row < 0)
+      continue;
+
+    size_t offset = (static_cast<size_t>(span.row) * cols_ + span.begin_col) * channels_;
+    uint8_t* pixels = image.ptr<uint8_t>(origin_row + span.row) + (origin_col + span.begin_col) * channels_;
+    blend_kernel(pixels, &weights_[offset], &premultiplied_[offset],
+                 static_cast<size_t>(span.end_col - span.begin_col) * channels_);
+  }
+}
+
+const char* WatermarkBlender::kernelName()
+{
+  return blend_kernel_name;
+}
+
+}  // namespace video_recorder
@@ -0,0 +1,119 @@
+/** @file
+ *
+ * Pool of worker threads shared by the recording sessions.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/worker_pool.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+namespace video_recorder
+{
+
+WorkerPool::WorkerPool(int num_threads)
+  : num_threads_(std::max(1, num_threads))
+    , virtual_time_(0)
+    , is_shutting_down_(false)
+{
+  for(int i = 0; i < num_threads_; ++i)
+    threads_.create_thread(boost::bind(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    is_shutting_down_ = true;
+  }
+  task_condition_.notify_all();
+  threads_.join_all();
+}
+
+void WorkerPool::addClient(WorkerPoolClient* client)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ClientState& state = clients_[client];
+    state.served_cost = virtual_time_;
+    state.is_removed = false;
+  }
+  task_condition_.notify_all();
+}
+
+void WorkerPool::removeClient(WorkerPoolClient* client)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<WorkerPoolClient*, ClientState>::iterator state = clients_.find(client);
+  if(state == clients_.end())
+    return;
+
+  state->second.is_removed = true;
+  while(state->second.num_running_tasks > 0)
+    finished_condition_.wait(lock);
+  clients_.erase(state);
+}
+
+void WorkerPool::notify()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+  }
+  task_condition_.notify_all();
+}
+
+void WorkerPool::work()
+{
+  while(true)
+  {
+    WorkerPoolClient* client = nullptr;
+    size_t cost = 0;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ClientState* state = nullptr;
+      while(!is_shutting_down_)
+      {
+        // the client with a task that was served the least cost so far is next
+        for(std::pair<WorkerPoolClient* const, ClientState>& entry : clients_)
+          if(!entry.second.is_removed && (!state || entry.second.served_cost < state->served_cost) &&
+             entry.first->hasTask())
+          {
+            client = entry.first;
+            state = &entry.second;
+          }
+
+        if(state)
+          break;
+        task_condition_.wait(lock);
+      }
+
+      if(is_shutting_down_)
+        return;
+
+      // a client that was idle must not monopolize the workers to catch up on the cost served to the others
+      state->served_cost = std::max(state->served_cost, virtual_time_);
+      virtual_time_ = state->served_cost;
+
+      // charge the task before running it, so that concurrent workers turn to the other clients
+      cost = client->taskCost();
+      state->served_cost += cost;
+      state->num_running_tasks++;
+    }
+
+    bool is_run = client->runTask();
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ClientState& state = clients_[client];
+      state.num_running_tasks--;
+      if(!is_run)
+        state.served_cost -= cost;
+    }
+    finished_condition_.notify_all();
+  }
+}
+
+}  // namespace video_recorder
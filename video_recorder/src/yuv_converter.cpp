@@ -0,0 +1,36 @@
+/** @file
+ *
+ * Conversion of color images to planar YUV 4:2:0.
+ *
+ * @author Jan Razlaw
+ */
+
+#include "video_recorder/yuv_converter.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace video_recorder
+{
+
+bool YuvConverter::isConvertible(const std::string& encoding)
+{
+  return encoding == "bgr8" || encoding == "rgb8" || encoding == "bgra8" || encoding == "rgba8";
+}
+
+void YuvConverter::convert(const cv::Mat& image, const std::string& encoding, cv::Mat& yuv)
+{
+  CV_Assert(isConvertible(encoding) && image.depth() == CV_8U && image.rows % 2 == 0 && image.cols % 2 == 0);
+
+  int code = cv::COLOR_BGR2YUV_I420;
+  if(encoding == "rgb8")
+    code = cv::COLOR_RGB2YUV_I420;
+  else if(encoding == "bgra8")
+    code = cv::COLOR_BGRA2YUV_I420;
+  else if(encoding == "rgba8")
+    code = cv::COLOR_RGBA2YUV_I420;
+
+  // cv::cvtColor reuses yuv if it already has the size and type of the result 
+  cv::cvtColor(image, yuv, code);
+}
+
+}  // namespace video_recorder